@@ -0,0 +1,646 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * In-kernel syscall counting (-c -X bpf).
+ *
+ * Two BPF programs on the raw_syscalls:sys_enter and sys_exit raw
+ * tracepoints keep, for every thread in the "tids" map, the entry time
+ * of its current syscall, and add calls, errors, and time to per-cpu
+ * counters indexed by personality and syscall number.  Each event
+ * costs one hash lookup; the thread's record is updated in place.
+ * With -f,
+ * a third program on sched:sched_process_fork adds the children
+ * of traced threads to "tids".  Tracees never stop; the counters
+ * are read once, when strace finishes, and fed to call_summary().
+ *
+ * The programs are assembled here rather than compiled, so that
+ * building strace needs neither clang nor libbpf.
+ */
+
+#include "defs.h"
+
+#if defined HAVE_LINUX_PERF_EVENT_H && defined __NR_bpf \
+ && defined __NR_perf_event_open
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <linux/filter.h>
+#include <linux/perf_event.h>
+
+#ifndef PERF_EVENT_IOC_SET_BPF
+# define PERF_EVENT_IOC_SET_BPF _IOW('$', 8, uint32_t)
+#endif
+
+/* eBPF additions to the classic BPF opcodes of <linux/filter.h>.  */
+#ifndef BPF_ALU64
+# define BPF_ALU64	0x07
+#endif
+#ifndef BPF_DW
+# define BPF_DW		0x18
+#endif
+#ifndef BPF_MOV
+# define BPF_MOV	0xb0
+#endif
+#ifndef BPF_JNE
+# define BPF_JNE	0x50
+#endif
+#ifndef BPF_JSGT
+# define BPF_JSGT	0x60
+#endif
+#ifndef BPF_CALL
+# define BPF_CALL	0x80
+#endif
+#ifndef BPF_EXIT
+# define BPF_EXIT	0x90
+#endif
+
+/* bpf(2) commands, map and program types, and helpers used here.  */
+enum {
+	BPFC_MAP_CREATE = 0,
+	BPFC_MAP_LOOKUP_ELEM = 1,
+	BPFC_MAP_UPDATE_ELEM = 2,
+	BPFC_MAP_DELETE_ELEM = 3,
+	BPFC_MAP_GET_NEXT_KEY = 4,
+	BPFC_PROG_LOAD = 5,
+	BPFC_RAW_TRACEPOINT_OPEN = 17,
+};
+enum {
+	BPFC_MAP_TYPE_HASH = 1,
+	BPFC_MAP_TYPE_PERCPU_ARRAY = 6,
+};
+enum {
+	BPFC_PROG_TYPE_TRACEPOINT = 5,
+	BPFC_PROG_TYPE_RAW_TRACEPOINT = 17,
+};
+enum {
+	BPFC_FUNC_map_lookup_elem = 1,
+	BPFC_FUNC_map_update_elem = 2,
+	BPFC_FUNC_map_delete_elem = 3,
+	BPFC_FUNC_probe_read = 4,
+	BPFC_FUNC_ktime_get_ns = 5,
+	BPFC_FUNC_get_current_pid_tgid = 14,
+};
+#define BPFC_PSEUDO_MAP_FD 1
+
+struct bpfc_insn {
+	uint8_t code;
+	uint8_t dst_reg:4;
+	uint8_t src_reg:4;
+	int16_t off;
+	int32_t imm;
+};
+
+/*
+ * The value of the "tids" map: when the current syscall of the thread
+ * started, and its "stats" slot, or NO_SLOT between syscalls.
+ */
+struct bpfc_thread {
+	uint64_t start;
+	uint64_t slot;
+};
+#define NO_SLOT ((uint64_t) -1)
+
+/* The value of the "stats" map: one per personality and syscall.  */
+struct bpfc_stats {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t ns;
+};
+
+#define BPFC_MAX_TIDS 65536
+
+static int tids_fd = -1;
+static int stats_fd = -1;
+/* Index range of syscall numbers of one personality in "stats".  */
+static unsigned int max_scno;
+
+static long
+sys_bpf(unsigned int cmd, void *attr, unsigned int size)
+{
+	return syscall(__NR_bpf, cmd, attr, size);
+}
+
+static int
+map_create(unsigned int type, unsigned int key_size, unsigned int value_size,
+	   unsigned int max_entries)
+{
+	struct {
+		uint32_t map_type, key_size, value_size, max_entries;
+	} attr = { type, key_size, value_size, max_entries };
+
+	return sys_bpf(BPFC_MAP_CREATE, &attr, sizeof(attr));
+}
+
+static int
+map_elem(unsigned int cmd, int fd, const void *key, void *value,
+	 uint64_t flags)
+{
+	struct {
+		uint32_t map_fd, pad;
+		uint64_t key, value, flags;
+	} attr = {
+		.map_fd = fd,
+		.key = (uintptr_t) key,
+		.value = (uintptr_t) value,
+		.flags = flags,
+	};
+
+	return sys_bpf(cmd, &attr, sizeof(attr));
+}
+
+/* A program under construction.  */
+struct bpfc_prog {
+	struct bpfc_insn insns[64];
+	unsigned int len;
+};
+
+#define INSN(c, d, s, o, i) \
+	((struct bpfc_insn) { .code = (c), .dst_reg = (d), .src_reg = (s), \
+			      .off = (o), .imm = (i) })
+#define MOV_REG(d, s)	INSN(BPF_ALU64 | BPF_MOV | BPF_X, (d), (s), 0, 0)
+#define MOV_IMM(d, i)	INSN(BPF_ALU64 | BPF_MOV | BPF_K, (d), 0, 0, (i))
+#define ALU_IMM(op, d, i) INSN(BPF_ALU64 | (op) | BPF_K, (d), 0, 0, (i))
+#define ALU_REG(op, d, s) INSN(BPF_ALU64 | (op) | BPF_X, (d), (s), 0, 0)
+#define LDX(sz, d, s, o) INSN(BPF_LDX | (sz) | BPF_MEM, (d), (s), (o), 0)
+#define STX(sz, d, s, o) INSN(BPF_STX | (sz) | BPF_MEM, (d), (s), (o), 0)
+#define ST_IMM(sz, d, o, i) INSN(BPF_ST | (sz) | BPF_MEM, (d), 0, (o), (i))
+#define JMP_IMM(op, d, i) INSN(BPF_JMP | (op) | BPF_K, (d), 0, 0, (i))
+#define CALL(f)		INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPFC_FUNC_ ## f)
+#define EXIT()		INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static unsigned int
+emit(struct bpfc_prog *p, struct bpfc_insn insn)
+{
+	if (p->len >= ARRAY_SIZE(p->insns))
+		error_msg_and_die("BPF program is too long");
+	p->insns[p->len] = insn;
+	return p->len++;
+}
+
+static void
+emit_map_fd(struct bpfc_prog *p, unsigned int reg, int fd)
+{
+	emit(p, INSN(BPF_LD | BPF_DW | BPF_IMM, reg, BPFC_PSEUDO_MAP_FD, 0, fd));
+	emit(p, INSN(0, 0, 0, 0, 0));
+}
+
+/* Make the jump at index JMP land on the next instruction emitted.  */
+static void
+land(struct bpfc_prog *p, unsigned int jmp)
+{
+	p->insns[jmp].off = p->len - jmp - 1;
+}
+
+/* r2 = r10 + OFF, a pointer to the stack.  */
+static void
+emit_stack_ptr(struct bpfc_prog *p, unsigned int reg, int off)
+{
+	emit(p, MOV_REG(reg, 10));
+	emit(p, ALU_IMM(BPF_ADD, reg, off));
+}
+
+static int
+prog_load(unsigned int type, const struct bpfc_prog *p)
+{
+	static char log[65536];
+	struct {
+		uint32_t prog_type, insn_cnt;
+		uint64_t insns, license;
+		uint32_t log_level, log_size;
+		uint64_t log_buf;
+	} attr = {
+		.prog_type = type,
+		.insn_cnt = p->len,
+		.insns = (uintptr_t) p->insns,
+		.license = (uintptr_t) "Dual BSD/GPL",
+	};
+	int fd;
+
+	fd = sys_bpf(BPFC_PROG_LOAD, &attr, sizeof(attr));
+	if (fd < 0 && debug_flag) {
+		int err = errno;
+
+		attr.log_level = 1;
+		attr.log_size = sizeof(log);
+		attr.log_buf = (uintptr_t) log;
+		if (sys_bpf(BPFC_PROG_LOAD, &attr, sizeof(attr)) < 0)
+			error_msg("BPF verifier log:\n%s", log);
+		errno = err;
+	}
+	return fd;
+}
+
+/* Load P and attach it to the raw tracepoint NAME.  */
+static int
+attach_raw_tracepoint(const char *name, const struct bpfc_prog *p)
+{
+	struct {
+		uint64_t name;
+		uint32_t prog_fd, pad;
+	} attr = { .name = (uintptr_t) name };
+	int fd = prog_load(BPFC_PROG_TYPE_RAW_TRACEPOINT, p);
+
+	if (fd < 0) {
+		perror_msg("bpf(BPF_PROG_LOAD, %s)", name);
+		return -1;
+	}
+	attr.prog_fd = fd;
+	if (sys_bpf(BPFC_RAW_TRACEPOINT_OPEN, &attr, sizeof(attr)) < 0) {
+		perror_msg("bpf(BPF_RAW_TRACEPOINT_OPEN, %s)", name);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * sys_enter: if the thread is traced, remember when its syscall
+ * started and which "stats" slot it is to be counted in.
+ * The context is the raw tracepoint arguments: regs, id.
+ */
+static void
+gen_sys_enter(struct bpfc_prog *p)
+{
+	unsigned int j_out;
+#ifdef X86_64
+	unsigned int j_x32, j_store, j_i386;
+#endif
+
+	emit(p, MOV_REG(6, 1));
+	emit(p, CALL(get_current_pid_tgid));
+	emit(p, STX(BPF_W, 10, 0, -4));
+	emit_map_fd(p, 1, tids_fd);
+	emit_stack_ptr(p, 2, -4);
+	emit(p, CALL(map_lookup_elem));
+	j_out = emit(p, JMP_IMM(BPF_JEQ, 0, 0));
+	emit(p, MOV_REG(8, 0));
+	emit(p, LDX(BPF_DW, 7, 6, 8));
+#ifdef X86_64
+	/*
+	 * The kernel tells x32 syscalls by __X32_SYSCALL_BIT
+	 * and i386 ones by the code segment of the caller.
+	 */
+	emit(p, MOV_REG(1, 7));
+	emit(p, ALU_IMM(BPF_AND, 1, 0x40000000));
+	j_x32 = emit(p, JMP_IMM(BPF_JEQ, 1, 0));
+	emit(p, ALU_IMM(BPF_SUB, 7, 0x40000000));
+	emit(p, ALU_IMM(BPF_ADD, 7, 2 * max_scno));
+	j_store = emit(p, INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0));
+	land(p, j_x32);
+	emit_stack_ptr(p, 1, -16);
+	emit(p, MOV_IMM(2, 8));
+	emit(p, LDX(BPF_DW, 3, 6, 0));
+	emit(p, ALU_IMM(BPF_ADD, 3, 17 * 8));	/* pt_regs.cs */
+	emit(p, CALL(probe_read));
+	emit(p, LDX(BPF_DW, 1, 10, -16));
+	j_i386 = emit(p, JMP_IMM(BPF_JNE, 1, 0x23));	/* __USER32_CS */
+	emit(p, ALU_IMM(BPF_ADD, 7, max_scno));
+	land(p, j_i386);
+	land(p, j_store);
+#endif
+	emit(p, CALL(ktime_get_ns));
+	emit(p, STX(BPF_DW, 8, 0, offsetof(struct bpfc_thread, start)));
+	emit(p, STX(BPF_DW, 8, 7, offsetof(struct bpfc_thread, slot)));
+	land(p, j_out);
+	emit(p, MOV_IMM(0, 0));
+	emit(p, EXIT());
+}
+
+/*
+ * sys_exit: count the syscall the thread has started, if any.
+ * The context is the raw tracepoint arguments: regs, ret.
+ */
+static void
+gen_sys_exit(struct bpfc_prog *p)
+{
+	unsigned int j_none, j_range, j_nostats, j_ok, j_err, j_done;
+
+	emit(p, MOV_REG(6, 1));
+	emit(p, CALL(get_current_pid_tgid));
+	emit(p, STX(BPF_W, 10, 0, -4));
+	emit_map_fd(p, 1, tids_fd);
+	emit_stack_ptr(p, 2, -4);
+	emit(p, CALL(map_lookup_elem));
+	j_none = emit(p, JMP_IMM(BPF_JEQ, 0, 0));
+	emit(p, LDX(BPF_DW, 7, 0, offsetof(struct bpfc_thread, start)));
+	emit(p, LDX(BPF_DW, 8, 0, offsetof(struct bpfc_thread, slot)));
+	emit(p, ST_IMM(BPF_DW, 0, offsetof(struct bpfc_thread, slot), -1));
+	j_range = emit(p, JMP_IMM(BPF_JGE, 8, SUPPORTED_PERSONALITIES * max_scno));
+	emit(p, STX(BPF_W, 10, 8, -8));
+	emit(p, CALL(ktime_get_ns));
+	emit(p, MOV_REG(9, 0));
+	emit(p, ALU_REG(BPF_SUB, 9, 7));
+	emit_map_fd(p, 1, stats_fd);
+	emit_stack_ptr(p, 2, -8);
+	emit(p, CALL(map_lookup_elem));
+	j_nostats = emit(p, JMP_IMM(BPF_JEQ, 0, 0));
+	emit(p, LDX(BPF_DW, 1, 0, offsetof(struct bpfc_stats, calls)));
+	emit(p, ALU_IMM(BPF_ADD, 1, 1));
+	emit(p, STX(BPF_DW, 0, 1, offsetof(struct bpfc_stats, calls)));
+	emit(p, LDX(BPF_DW, 1, 0, offsetof(struct bpfc_stats, ns)));
+	emit(p, ALU_REG(BPF_ADD, 1, 9));
+	emit(p, STX(BPF_DW, 0, 1, offsetof(struct bpfc_stats, ns)));
+	/* An error is a return value in -4095..-1, as in syscall.c.  */
+	emit(p, LDX(BPF_DW, 2, 6, 8));
+	j_ok = emit(p, JMP_IMM(BPF_JSGT, 2, -1));
+	j_err = emit(p, JMP_IMM(BPF_JSGT, 2, -4096));
+	j_done = emit(p, INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0));
+	land(p, j_err);
+	emit(p, LDX(BPF_DW, 1, 0, offsetof(struct bpfc_stats, errors)));
+	emit(p, ALU_IMM(BPF_ADD, 1, 1));
+	emit(p, STX(BPF_DW, 0, 1, offsetof(struct bpfc_stats, errors)));
+	land(p, j_none);
+	land(p, j_range);
+	land(p, j_nostats);
+	land(p, j_ok);
+	land(p, j_done);
+	emit(p, MOV_IMM(0, 0));
+	emit(p, EXIT());
+}
+
+/*
+ * sched_process_fork: a child of a traced thread is traced too.
+ * The context is the tracepoint record, with the offsets of the pid
+ * fields taken from its format file.
+ */
+static void
+gen_fork(struct bpfc_prog *p, int parent_off, int child_off)
+{
+	unsigned int j_out;
+
+	emit(p, MOV_REG(6, 1));
+	emit(p, LDX(BPF_W, 1, 6, parent_off));
+	emit(p, STX(BPF_W, 10, 1, -4));
+	emit_map_fd(p, 1, tids_fd);
+	emit_stack_ptr(p, 2, -4);
+	emit(p, CALL(map_lookup_elem));
+	j_out = emit(p, JMP_IMM(BPF_JEQ, 0, 0));
+	emit(p, LDX(BPF_W, 1, 6, child_off));
+	emit(p, STX(BPF_W, 10, 1, -4));
+	emit(p, ST_IMM(BPF_DW, 10, -24, 0));
+	emit(p, ST_IMM(BPF_DW, 10, -16, -1));
+	emit_map_fd(p, 1, tids_fd);
+	emit_stack_ptr(p, 2, -4);
+	emit_stack_ptr(p, 3, -24);
+	emit(p, MOV_IMM(4, 0));
+	emit(p, CALL(map_update_elem));
+	land(p, j_out);
+	emit(p, MOV_IMM(0, 0));
+	emit(p, EXIT());
+}
+
+/* Attach P to the sched_process_fork tracepoint on every CPU.  */
+static int
+attach_fork_tracepoint(const struct bpfc_prog *p)
+{
+	struct perf_event_attr attr;
+	int id = tracefs_event_id("sched/sched_process_fork");
+	int cpu, ncpus, prog_fd, fd, n = 0;
+
+	if (id < 0) {
+		error_msg("cannot find sched_process_fork in tracefs");
+		return -1;
+	}
+
+	prog_fd = prog_load(BPFC_PROG_TYPE_TRACEPOINT, p);
+	if (prog_fd < 0) {
+		perror_msg("bpf(BPF_PROG_LOAD, sched_process_fork)");
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	attr.sample_period = 1;
+	attr.wakeup_events = 1;
+	ncpus = cpu_list_max("/sys/devices/system/cpu/online") + 1;
+	for (cpu = 0; cpu < ncpus; ++cpu) {
+		fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+		if (fd < 0)
+			continue;	/* offline */
+		if (ioctl(fd, PERF_EVENT_IOC_SET_BPF, prog_fd) < 0 ||
+		    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+			perror_msg("ioctl(PERF_EVENT_IOC_SET_BPF)");
+			return -1;
+		}
+		set_cloexec_flag(fd);
+		++n;
+	}
+	if (!n) {
+		perror_msg("perf_event_open(sched_process_fork)");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Thread ids seen by BPF programs are those of the initial pid
+ * namespace, strace has to live there for them to match its own.
+ */
+static bool
+in_initial_pid_ns(void)
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	char line[256];
+	bool ret = true;
+
+	if (!fp)
+		return false;
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "NSpid:", 6) == 0) {
+			ret = !strchr(line + 7, '\t');
+			break;
+		}
+	}
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Set up the maps and programs.
+ * Return 0 on success, -1 if BPF cannot be used.
+ */
+int
+bpfcount_init(void)
+{
+	struct bpfc_prog p;
+	unsigned int pers, old_pers = current_personality;
+
+	if (!in_initial_pid_ns()) {
+		error_msg("-X bpf: not in the initial pid namespace");
+		return -1;
+	}
+
+	for (pers = 0; pers < SUPPORTED_PERSONALITIES; ++pers) {
+		set_personality(pers);
+		if (max_scno < nsyscalls)
+			max_scno = nsyscalls;
+	}
+	set_personality(old_pers);
+
+	tids_fd = map_create(BPFC_MAP_TYPE_HASH, sizeof(uint32_t),
+			     sizeof(struct bpfc_thread), BPFC_MAX_TIDS);
+	stats_fd = map_create(BPFC_MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t),
+			      sizeof(struct bpfc_stats),
+			      SUPPORTED_PERSONALITIES * max_scno);
+	if (tids_fd < 0 || stats_fd < 0) {
+		perror_msg("bpf(BPF_MAP_CREATE)");
+		return -1;
+	}
+	set_cloexec_flag(tids_fd);
+	set_cloexec_flag(stats_fd);
+
+	if (followfork) {
+		const char *event = "sched/sched_process_fork";
+		int parent_off = tracefs_field_offset(event, "parent_pid");
+		int child_off = tracefs_field_offset(event, "child_pid");
+
+		if (parent_off < 0 || child_off < 0) {
+			error_msg("cannot parse the format of %s", event);
+			return -1;
+		}
+		memset(&p, 0, sizeof(p));
+		gen_fork(&p, parent_off, child_off);
+		if (attach_fork_tracepoint(&p) < 0)
+			return -1;
+	}
+
+	memset(&p, 0, sizeof(p));
+	gen_sys_enter(&p);
+	if (attach_raw_tracepoint("sys_enter", &p) < 0)
+		return -1;
+	memset(&p, 0, sizeof(p));
+	gen_sys_exit(&p);
+	if (attach_raw_tracepoint("sys_exit", &p) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* Start counting the syscalls of thread TID.  */
+void
+bpfcount_add(int tid)
+{
+	uint32_t key = tid;
+	struct bpfc_thread idle = { 0, NO_SLOT };
+
+	if (map_elem(BPFC_MAP_UPDATE_ELEM, tids_fd, &key, &idle, 0) < 0)
+		perror_msg_and_die("bpf(BPF_MAP_UPDATE_ELEM)");
+}
+
+/*
+ * Forget the threads that have gone away.
+ * Return the number of traced threads that are still there.
+ */
+unsigned int
+bpfcount_alive(void)
+{
+	uint32_t key = 0, next, *dead = NULL;
+	unsigned int ndead = 0, nalive = 0, i;
+
+	while (map_elem(BPFC_MAP_GET_NEXT_KEY, tids_fd,
+			&key, &next, 0) == 0) {
+		key = next;
+		if (kill(key, 0) == 0 || errno != ESRCH) {
+			++nalive;
+			continue;
+		}
+		dead = xreallocarray(dead, ndead + 1, sizeof(*dead));
+		dead[ndead++] = key;
+	}
+	for (i = 0; i < ndead; ++i)
+		map_elem(BPFC_MAP_DELETE_ELEM, tids_fd, &dead[i], NULL, 0);
+	free(dead);
+
+	return nalive;
+}
+
+/* Add the counters of all CPUs to the call summary.  */
+void
+bpfcount_collect(void)
+{
+	const unsigned int ncpus =
+		cpu_list_max("/sys/devices/system/cpu/possible") + 1;
+	struct bpfc_stats *percpu = xcalloc(ncpus, sizeof(*percpu));
+	unsigned int pers, scno, cpu, old_pers = current_personality;
+
+	for (pers = 0; pers < SUPPORTED_PERSONALITIES; ++pers) {
+		set_personality(pers);
+		for (scno = 0; scno < nsyscalls; ++scno) {
+			uint32_t key = pers * max_scno + scno;
+			struct bpfc_stats sum = { 0, 0, 0 };
+			struct timespec ts;
+
+			if (!(qual_flags[scno] & QUAL_TRACE))
+				continue;
+			if (map_elem(BPFC_MAP_LOOKUP_ELEM, stats_fd,
+				     &key, percpu, 0) < 0)
+				continue;
+			for (cpu = 0; cpu < ncpus; ++cpu) {
+				sum.calls += percpu[cpu].calls;
+				sum.errors += percpu[cpu].errors;
+				sum.ns += percpu[cpu].ns;
+			}
+			if (!sum.calls)
+				continue;
+			ts.tv_sec = sum.ns / 1000000000;
+			ts.tv_nsec = sum.ns % 1000000000;
+			count_syscall_totals(scno, sum.calls, sum.errors, &ts);
+		}
+	}
+	set_personality(old_pers);
+	free(percpu);
+}
+
+#else /* !(HAVE_LINUX_PERF_EVENT_H && __NR_bpf && __NR_perf_event_open) */
+
+int
+bpfcount_init(void)
+{
+	error_msg("-X bpf is not supported by this build of strace");
+	return -1;
+}
+
+void
+bpfcount_add(int tid)
+{
+}
+
+unsigned int
+bpfcount_alive(void)
+{
+	return 0;
+}
+
+void
+bpfcount_collect(void)
+{
+}
+
+#endif
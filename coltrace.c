@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Columnar trace file (-W).  Each syscall that is shown is also
+ * recorded as a row of the file described in coltrace.h.  Rows are
+ * collected in per-column arrays and encoded a block at a time.
+ *
+ * Syscalls are not decoded a second time for the path and fd columns:
+ * printpathn() and printfd() hand over the first path and fd they
+ * print, if the sysent flags of the syscall say it takes paths
+ * (TRACE_FILE) or fds (TRACE_DESC, TRACE_NETWORK).
+ */
+
+#include "defs.h"
+#include "coltrace.h"
+
+FILE *coltrace_fp;
+
+static uint64_t *columns[COLTRACE_NCOLS];
+static unsigned int nrecords;
+static int64_t last_time;
+
+/* Strings first used in the current block, encoded */
+static unsigned char *strings;
+static size_t strings_len;
+static size_t strings_size;
+static unsigned int nstrings;
+
+/* All strings of the file, in a hash table with linear probing */
+struct dict_entry {
+	char *str;
+	size_t len;
+	uint64_t hash;
+	unsigned int id;
+};
+
+static struct dict_entry *dict;
+static size_t dict_size;
+static unsigned int dict_count;
+
+static void
+dict_grow(void)
+{
+	struct dict_entry *old = dict;
+	size_t old_size = dict_size;
+	size_t i;
+
+	dict_size = dict_size ? dict_size * 2 : 1024;
+	dict = xcalloc(dict_size, sizeof(*dict));
+	for (i = 0; i < old_size; ++i) {
+		size_t j;
+
+		if (!old[i].str)
+			continue;
+		for (j = old[i].hash & (dict_size - 1); dict[j].str;
+		     j = (j + 1) & (dict_size - 1))
+			;
+		dict[j] = old[i];
+	}
+	free(old);
+}
+
+/* Return the number of string STR of length LEN, adding it if new.  */
+static unsigned int
+coltrace_string(const char *str, size_t len)
+{
+	const uint64_t hash = hash_text(str, len);
+	size_t i;
+
+	if (dict_count * 2 >= dict_size)
+		dict_grow();
+
+	for (i = hash & (dict_size - 1); dict[i].str;
+	     i = (i + 1) & (dict_size - 1)) {
+		if (dict[i].hash == hash && dict[i].len == len &&
+		    memcmp(dict[i].str, str, len) == 0)
+			return dict[i].id;
+	}
+
+	dict[i].str = xmalloc(len);
+	memcpy(dict[i].str, str, len);
+	dict[i].len = len;
+	dict[i].hash = hash;
+	dict[i].id = ++dict_count;
+
+	if (strings_size - strings_len < len + 10) {
+		strings_size = (strings_len + len + 10) * 2;
+		strings = xreallocarray(strings, strings_size, 1);
+	}
+	strings_len = coltrace_put(strings + strings_len, len) - strings;
+	memcpy(strings + strings_len, str, len);
+	strings_len += len;
+	++nstrings;
+
+	return dict[i].id;
+}
+
+static void
+coltrace_write(const void *buf, size_t len)
+{
+	if (fwrite(buf, 1, len, coltrace_fp) != len)
+		perror_msg_and_die("write columnar trace");
+}
+
+static void
+coltrace_flush(void)
+{
+	static unsigned char *buf;
+	unsigned char head[20];
+	unsigned int i;
+
+	if (!nrecords && !nstrings)
+		return;
+	if (!buf)
+		buf = xmalloc(COLTRACE_BLOCK_SIZE * 10);
+
+	coltrace_write(head, coltrace_put(coltrace_put(head, nrecords),
+					  nstrings) - head);
+	coltrace_write(strings, strings_len);
+
+	for (i = 0; i < COLTRACE_NCOLS; ++i) {
+		unsigned char *p = buf;
+		unsigned int j;
+
+		for (j = 0; j < nrecords; ++j)
+			p = coltrace_put(p, columns[i][j]);
+		coltrace_write(head, coltrace_put(head, p - buf) - head);
+		coltrace_write(buf, p - buf);
+	}
+
+	nrecords = 0;
+	nstrings = 0;
+	strings_len = 0;
+}
+
+void
+coltrace_open(const char *path)
+{
+	coltrace_fp = fopen(path, "w");
+	if (!coltrace_fp)
+		perror_msg_and_die("Can't fopen '%s'", path);
+	coltrace_write(COLTRACE_MAGIC, COLTRACE_MAGIC_SIZE);
+}
+
+void
+coltrace_close(void)
+{
+	coltrace_flush();
+	if (fclose(coltrace_fp))
+		perror_msg("write columnar trace");
+	coltrace_fp = NULL;
+}
+
+void
+coltrace_path(struct tcb *tcp, const char *path, size_t len)
+{
+	if (!tcp->col_path && (tcp->s_ent->sys_flags & TRACE_FILE))
+		tcp->col_path = coltrace_string(path, len);
+}
+
+void
+coltrace_fd(struct tcb *tcp, int fd)
+{
+	if (!tcp->col_fd && fd >= 0 &&
+	    (tcp->s_ent->sys_flags & (TRACE_DESC | TRACE_NETWORK)))
+		tcp->col_fd = fd + 1;
+}
+
+/* Record the syscall of TCP, which returned at TS.  */
+void
+coltrace_record(struct tcb *tcp, const struct timespec *ts)
+{
+	const char *name = tcp->s_ent->sys_name;
+	struct timespec rt = tcp->etime;
+	struct timespec dts;
+	int64_t time;
+
+	if (!columns[0]) {
+		unsigned int i;
+
+		for (i = 0; i < COLTRACE_NCOLS; ++i)
+			columns[i] = xcalloc(COLTRACE_BLOCK_SIZE,
+					     sizeof(columns[i][0]));
+	}
+
+	clock_to_realtime(&rt);
+	time = (int64_t) rt.tv_sec * 1000000000 + rt.tv_nsec;
+	ts_sub(&dts, ts, &tcp->etime);
+
+	columns[COLTRACE_TIME][nrecords] = coltrace_zigzag(time - last_time);
+	columns[COLTRACE_TID][nrecords] = tcp->pid;
+	columns[COLTRACE_SYSCALL][nrecords] =
+		coltrace_string(name, strlen(name));
+	columns[COLTRACE_RETVAL][nrecords] =
+		coltrace_zigzag(tcp->u_error ? -1 : tcp->u_rval);
+	columns[COLTRACE_ERRNO][nrecords] = tcp->u_error;
+	columns[COLTRACE_DURATION][nrecords] =
+		(uint64_t) dts.tv_sec * 1000000000 + dts.tv_nsec;
+	columns[COLTRACE_PATH][nrecords] = tcp->col_path;
+	columns[COLTRACE_FD][nrecords] = tcp->col_fd;
+	last_time = time;
+
+	if (++nrecords == COLTRACE_BLOCK_SIZE)
+		coltrace_flush();
+}
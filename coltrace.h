@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STRACE_COLTRACE_H
+#define STRACE_COLTRACE_H
+
+/*
+ * Columnar trace file, written with -W and read by strace-query.
+ *
+ * The file starts with COLTRACE_MAGIC and is followed by blocks of up
+ * to COLTRACE_BLOCK_SIZE records.  All numbers are unsigned LEB128
+ * varints, signed ones are zigzag encoded first.  A block is
+ *
+ *   nrec
+ *   nstr, then nstr times: length, bytes
+ *   COLTRACE_NCOLS times: length in bytes, then nrec values
+ *
+ * The strings of a block are those first used in it; they are numbered
+ * from 1 in the order they appear in the file, and string columns refer
+ * to them by number, 0 meaning none.
+ */
+
+#define COLTRACE_MAGIC		"STRACOL1"
+#define COLTRACE_MAGIC_SIZE	(sizeof(COLTRACE_MAGIC) - 1)
+#define COLTRACE_BLOCK_SIZE	4096
+
+enum coltrace_column {
+	COLTRACE_TIME,		/* Entry time in ns, delta to the previous record, signed */
+	COLTRACE_TID,
+	COLTRACE_SYSCALL,	/* String: the syscall name */
+	COLTRACE_RETVAL,	/* Signed */
+	COLTRACE_ERRNO,		/* 0 on success */
+	COLTRACE_DURATION,	/* In ns */
+	COLTRACE_PATH,		/* String: the first path argument */
+	COLTRACE_FD,		/* The first fd argument plus 1, 0 if none */
+	COLTRACE_NCOLS
+};
+
+static inline uint64_t
+coltrace_zigzag(int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t
+coltrace_unzigzag(uint64_t v)
+{
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/* Store V at P, which must have room for 10 bytes; return the end.  */
+static inline unsigned char *
+coltrace_put(unsigned char *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+/* Load a value from [*P, END) to *V; return false if it is truncated.  */
+static inline bool
+coltrace_get(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+	unsigned int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 64) {
+		const unsigned char c = *(*p)++;
+
+		*v |= (uint64_t) (c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+		shift += 7;
+	}
+	return false;
+}
+
+#endif /* !STRACE_COLTRACE_H */
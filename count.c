@@ -48,8 +48,9 @@ static struct call_counts *countv[SUPPORTED_PERSONALITIES];
 static struct timeval shortest = { 1000000, 0 };
 
 void
-count_syscall(struct tcb *tcp, const struct timeval *syscall_exiting_tv)
+count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 {
+	struct timespec wts;
 	struct timeval wtv;
 	struct timeval *tv = &wtv;
 	struct call_counts *cc;
@@ -67,7 +68,9 @@ count_syscall(struct tcb *tcp, const struct timeval *syscall_exiting_tv)
 		cc->errors++;
 
 	/* tv = wall clock time spent while in syscall */
-	tv_sub(tv, syscall_exiting_tv, &tcp->etime);
+	ts_sub(&wts, syscall_exiting_ts, &tcp->etime);
+	wtv.tv_sec = wts.tv_sec;
+	wtv.tv_usec = wts.tv_nsec / 1000;
 
 	/* Spent more wall clock time than spent system time? (usually yes) */
 	if (tv_cmp(tv, &tcp->dtime) > 0) {
@@ -151,6 +154,61 @@ void set_overhead(int n)
 	overhead.tv_usec = n % 1000000;
 }
 
+/*
+ * Add totals counted without stopping tracees (-X bpf).  There is
+ * no ptrace overhead in their times, so unless -O says otherwise,
+ * none is subtracted.
+ */
+void
+count_syscall_totals(unsigned long scno, unsigned int calls,
+		     unsigned int errors, const struct timespec *ts)
+{
+	struct call_counts *cc;
+	struct timeval tv;
+
+	if (!SCNO_IN_RANGE(scno))
+		return;
+	if (overhead.tv_sec == -1)
+		set_overhead(0);
+
+	if (!counts)
+		counts = xcalloc(nsyscalls, sizeof(*counts));
+	cc = &counts[scno];
+
+	cc->calls += calls;
+	cc->errors += errors;
+	tv.tv_sec = ts->tv_sec;
+	tv.tv_usec = ts->tv_nsec / 1000;
+	tv_add(&cc->time, &cc->time, &tv);
+}
+
+/* Multiply all the counts by FACTOR, e.g. to make up for -A.  */
+void
+scale_counts(double factor)
+{
+	unsigned int p, i, old_pers = current_personality;
+
+	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (!countv[p])
+			continue;
+
+		if (current_personality != p)
+			set_personality(p);
+		for (i = 0; i < nsyscalls; ++i) {
+			struct call_counts *cc = &counts[i];
+			double t = tv_float(&cc->time) * factor;
+
+			cc->calls = cc->calls * factor + 0.5;
+			cc->errors = cc->errors * factor + 0.5;
+			cc->time.tv_sec = t;
+			cc->time.tv_usec = (t - cc->time.tv_sec) * 1e6;
+		}
+	}
+
+	if (old_pers != current_personality)
+		set_personality(old_pers);
+}
+
 static void
 call_summary_pers(FILE *outf)
 {
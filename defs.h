@@ -215,6 +215,7 @@ typedef struct ioctlent {
 struct tcb {
 	int flags;		/* See below for TCB_ values */
 	int pid;		/* If 0, this tcb is free */
+	struct tcb *pid_next;	/* Next tcb in its pid2tcb hash bucket */
 	int qual_flg;		/* qual_flags[scno] or DEFAULT_QUAL_FLAGS + RAW */
 	unsigned long u_error;	/* Error code */
 	long scno;		/* System call number */
@@ -230,6 +231,22 @@ struct tcb {
 	int sys_func_rval;	/* Syscall entry parser's return value */
 	int curcol;		/* Output column for this process */
 	FILE *outf;		/* Output file for this process */
+	char *outbuf;		/* Its stdio buffer if -B was given with -ff */
+	FILE *defer_fp;		/* Memory stream for deferred lines */
+	char *defer_buf;	/* Its buffer */
+	size_t defer_size;
+	size_t defer_len;	/* Length of the deferred syscall entry */
+	FILE *defer_outf;	/* outf while the entry is rendered to memory */
+	size_t defer_text;	/* Where the leader of the deferred line ends */
+	int tgid;		/* Thread group id, if known; see json.c */
+	unsigned int col_path;	/* Path argument for -W, see coltrace.c */
+	unsigned int col_fd;	/* Fd argument plus 1 for -W */
+	uint64_t repeat_hash;	/* Hash of the last line shown, if TCB_REPEAT */
+	unsigned int repeat_count; /* Lines like it not shown since */
+	struct timespec repeat_first; /* Exit time of the last line shown */
+	struct timespec repeat_last; /* Exit time of its last repeat */
+	struct perf_events *perf_events; /* Its -X perf events, see perftrace.c */
+	unsigned int governor_level; /* -g level its syscall was entered at */
 	const char *auxstr;	/* Auxiliary info from syscall (see RVAL_STR) */
 	void *_priv_data;	/* Private data for syscall decoding functions */
 	void (*_free_priv_data)(void *); /* Callback for freeing priv_data */
@@ -237,7 +254,7 @@ struct tcb {
 	const struct_sysent *s_prev_ent; /* for "resuming interrupted SYSCALL" msg */
 	struct timeval stime;	/* System time usage as of last process wait */
 	struct timeval dtime;	/* Delta for system time usage */
-	struct timeval etime;	/* Syscall entry time */
+	struct timespec etime;	/* Syscall entry time, see clock_now() */
 
 #ifdef USE_LIBUNWIND
 	struct UPT_info* libunwind_ui;
@@ -271,6 +288,10 @@ struct tcb {
 #define TCB_ATTACHED	0x08	/* We attached to it already */
 #define TCB_REPRINT	0x10	/* We should reprint this syscall on exit */
 #define TCB_FILTERED	0x20	/* This system call has been filtered out */
+#define TCB_DEFERRED	0x40	/* Entry of this syscall is not printed yet */
+#define TCB_REPEAT	0x80	/* Later syscall lines are compared with repeat_hash */
+#define TCB_GONE	0x100	/* -X perf, seccomp: found gone, exit yet to be seen */
+#define TCB_DETACHING	0x200	/* Told to stop by cleanup, to be detached then */
 
 /* qualifier flags */
 #define QUAL_TRACE	0x001	/* this system call should be traced */
@@ -382,14 +403,30 @@ typedef enum {
 	CFLAG_BOTH
 } cflag_t;
 extern cflag_t cflag;
+typedef enum {
+	BACKEND_PTRACE = 0,
+	BACKEND_BPF,
+	BACKEND_PERF,
+	BACKEND_SECCOMP
+} backend_t;
+extern backend_t backend;
 extern bool debug_flag;
 extern bool Tflag;
 extern bool iflag;
 extern bool count_wallclock;
 extern unsigned int qflag;
 extern bool not_failing_only;
+extern bool failing_only;
+extern bool collapse_repeats;
+extern bool json_output;
+extern bool status_filter;
 extern unsigned int show_fd_path;
+extern unsigned int outbuf_size;
+extern bool measure_syscall_time;
+extern bool defer_lines;
+extern struct timespec latency_min;
 extern bool hide_log_until_execve;
+extern bool detach_on_execve;
 /* are we filtering traces based on paths? */
 extern const char **paths_selected;
 #define tracing_paths (paths_selected != NULL)
@@ -437,10 +474,74 @@ extern int read_int_from_file(const char *, int *);
 extern void set_sortby(const char *);
 extern void set_overhead(int);
 extern void qualify(const char *);
+extern unsigned int *traced_scnos(unsigned int personality, unsigned int *count);
 extern void print_pc(struct tcb *);
 extern int trace_syscall(struct tcb *);
-extern void count_syscall(struct tcb *, const struct timeval *);
+extern int snapshot_syscall_entering(struct tcb *);
+extern void count_syscall(struct tcb *, const struct timespec *);
+extern void count_syscall_totals(unsigned long, unsigned int, unsigned int, const struct timespec *);
+extern int bpfcount_init(void);
+extern void bpfcount_add(int);
+extern unsigned int bpfcount_alive(void);
+extern void bpfcount_collect(void);
+extern int perftrace_init(void);
+extern int perftrace_add(struct tcb *);
+extern void perftrace_drop(struct tcb *);
+extern void perftrace_wait(int);
+extern void perftrace_decode(bool);
+extern int seccomptrace_init(void);
+extern void seccomptrace_install(void);
+extern int seccomptrace_attach(int);
+extern bool seccomptrace_wait(int);
+extern bool seccomptrace_alive(void);
+extern void seccomptrace_decode(void);
+extern void backend_gone(struct tcb *);
+/* Cheaper modes the overhead governor (-g) switches to, in turn */
+enum {
+	GOVERNOR_FULL,
+	GOVERNOR_ABBREV,	/* Structures are abbreviated */
+	GOVERNOR_NO_PATHS,	/* No -y */
+	GOVERNOR_NO_STACKS,	/* No -k */
+	GOVERNOR_COUNT_ONLY	/* As with -c */
+};
+extern unsigned int governor_level;
+extern bool governor_counted;
+extern int governor_option(const char *);
+extern bool governor_enabled(void);
+extern void governor_init(void);
+extern void governor_wait_begin(void);
+extern void governor_wait_end(void);
+extern void governor_check(struct tcb *);
+struct snapshot;
+extern struct snapshot *snapshot_read(int);
+extern void snapshot_print(struct tcb *, struct snapshot *);
+extern void snapshot_free(struct snapshot *);
+extern FILE *tracefs_fopen(const char *, const char *);
+extern int tracefs_event_id(const char *);
+extern int tracefs_field_offset(const char *, const char *);
+extern int cpu_list_max(const char *);
+
+extern size_t flightrec_size;
+extern bool flightrec_on_signal;
+extern struct timespec flightrec_latency;
+extern int flightrec_option(const char *);
+extern FILE *flightrec_fopen(FILE *);
+extern void flightrec_dump(FILE *);
+extern bool flightrec_syscall_trigger(struct tcb *, const struct timespec *);
+extern void flightrec_trigger(struct tcb *);
+extern int gzlog_level;
+extern int gzlog_option(const char *);
+extern FILE *gzlog_fopen(FILE *);
+extern void json_print_syscall(struct tcb *, const char *, size_t, const struct timespec *, int);
+extern void json_print_event(struct tcb *, const char *, size_t);
+extern FILE *coltrace_fp;
+extern void coltrace_open(const char *);
+extern void coltrace_close(void);
+extern void coltrace_path(struct tcb *, const char *, size_t);
+extern void coltrace_fd(struct tcb *, int);
+extern void coltrace_record(struct tcb *, const struct timespec *);
 extern void call_summary(FILE *);
+extern void scale_counts(double);
 
 extern void clear_regs(void);
 extern void get_regs(pid_t pid);
@@ -511,6 +612,14 @@ extern const char *xlat_search(const struct xlat *, const size_t, const uint64_t
 
 extern unsigned long get_pagesize(void);
 extern int string_to_uint(const char *str);
+extern void set_cloexec_flag(int);
+extern int strace_child;
+extern struct tcb *pid2tcb(int);
+extern struct tcb *alloctcb(int);
+extern void droptcb(struct tcb *);
+extern void newoutf(struct tcb *);
+extern void print_exited(struct tcb *, int, int);
+extern void print_signalled(struct tcb *, int, int);
 extern int next_set_bit(const void *bit_array, unsigned cur_bit, unsigned size_bits);
 
 #define QUOTE_0_TERMINATED                      0x01
@@ -653,6 +762,10 @@ extern void tv_add(struct timeval *, const struct timeval *, const struct timeva
 extern void tv_sub(struct timeval *, const struct timeval *, const struct timeval *);
 extern void tv_mul(struct timeval *, const struct timeval *, int);
 extern void tv_div(struct timeval *, const struct timeval *, int);
+extern void ts_sub(struct timespec *, const struct timespec *, const struct timespec *);
+extern void ts_add(struct timespec *, const struct timespec *, const struct timespec *);
+extern int ts_cmp(const struct timespec *, const struct timespec *);
+extern int parse_duration(const char *, struct timespec *);
 
 #ifdef USE_LIBUNWIND
 extern void unwind_init(void);
@@ -717,15 +830,33 @@ printxval_long(const struct xlat *x, const unsigned long val, const char *dflt)
  * strace -oLOG -f[f] -p "`pidof web_browser`"
  */
 extern struct tcb *printing_tcp;
+extern struct tcb *current_tcp;
 extern void printleader(struct tcb *);
 extern void line_ended(void);
 extern void tabto(void);
+extern void start_deferred_line(struct tcb *);
+extern void suspend_deferred_line(struct tcb *);
+extern void commit_deferred_line(struct tcb *);
+extern void drop_deferred_line(struct tcb *);
+extern void resume_deferred_line(struct tcb *);
+extern uint64_t hash_text(const char *, size_t);
+extern bool finish_deferred_line(struct tcb *, size_t, const struct timespec *, int);
 extern void tprintf(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
 extern void tprints(const char *str);
+extern void tprintn(const char *str, size_t len);
+extern void tprint_dec(long long);
+extern void tprint_udec(unsigned long long);
+extern void tprint_hex(unsigned long long);
+extern void tprint_timespec(const struct timespec *, int width);
+extern clockid_t clock_id;
+extern const struct timespec *event_time;
+extern void clock_now(struct timespec *);
+extern void clock_to_realtime(struct timespec *);
 
 #if SUPPORTED_PERSONALITIES > 1
 extern void set_personality(int personality);
 extern unsigned current_personality;
+extern void update_personality(struct tcb *, unsigned int);
 #else
 # define set_personality(personality) ((void)0)
 # define current_personality 0
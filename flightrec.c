@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Flight recorder (-R): trace output is kept in an in-memory ring
+ * and written out only when one of the triggers fires.
+ *
+ * The ring is hidden behind a stdio stream created with fopencookie,
+ * so the rest of strace prints to it exactly as it prints to a log
+ * file; what used to be a write(2) per line becomes a memcpy.
+ */
+
+#include "defs.h"
+
+#ifdef HAVE_FOPENCOOKIE
+
+struct flightrec {
+	struct flightrec *next;
+	FILE *fp;	/* The stream strace prints to */
+	FILE *dest;	/* Where the ring is written when a trigger fires */
+	char *buf;
+	size_t pos;	/* Offset of the next byte to be written */
+	bool wrapped;	/* Whether buf has been filled at least once */
+};
+
+struct errno_trigger {
+	const char *syscall;
+	const char *error;
+};
+
+size_t flightrec_size;
+bool flightrec_on_signal;
+struct timespec flightrec_latency;
+
+static struct flightrec *rings;
+static struct errno_trigger *errno_triggers;
+static unsigned int n_errno_triggers;
+
+static ssize_t
+flightrec_write(void *cookie, const char *data, size_t len)
+{
+	struct flightrec *fr = cookie;
+	const size_t ret = len;
+	size_t n;
+
+	if (len >= flightrec_size) {
+		data += len - flightrec_size;
+		len = flightrec_size;
+	}
+	n = flightrec_size - fr->pos;
+	if (n > len)
+		n = len;
+	memcpy(fr->buf + fr->pos, data, n);
+	memcpy(fr->buf, data + n, len - n);
+	fr->pos += len;
+	if (fr->pos >= flightrec_size) {
+		fr->pos -= flightrec_size;
+		fr->wrapped = true;
+	}
+
+	return ret;
+}
+
+static int
+flightrec_close(void *cookie)
+{
+	struct flightrec *fr = cookie;
+	struct flightrec **p;
+	int rc = 0;
+
+	for (p = &rings; *p; p = &(*p)->next) {
+		if (*p == fr) {
+			*p = fr->next;
+			break;
+		}
+	}
+	if (fr->dest != stderr)
+		rc = fclose(fr->dest);
+	free(fr->buf);
+	free(fr);
+
+	return rc;
+}
+
+/* Return a stream that records into a new ring in front of DEST.  */
+FILE *
+flightrec_fopen(FILE *dest)
+{
+	static const cookie_io_functions_t funcs = {
+		.write = flightrec_write,
+		.close = flightrec_close,
+	};
+	struct flightrec *fr = xcalloc(1, sizeof(*fr));
+
+	fr->dest = dest;
+	fr->buf = xmalloc(flightrec_size);
+	fr->fp = fopencookie(fr, "w", funcs);
+	if (!fr->fp)
+		perror_msg_and_die("fopencookie");
+	fr->next = rings;
+	rings = fr;
+
+	return fr->fp;
+}
+
+/*
+ * Write out the complete lines in the ring of FR.  A line that is
+ * still being printed stays in the ring and goes out with the next dump.
+ */
+static void
+flightrec_write_out(struct flightrec *fr)
+{
+	char *data = fr->buf;
+	size_t len = fr->pos;
+	const char *start, *end;
+
+	fflush(fr->fp);
+	if (fr->wrapped) {
+		/* Put the oldest byte first.  */
+		data = xmalloc(flightrec_size);
+		len = flightrec_size - fr->pos;
+		memcpy(data, fr->buf + fr->pos, len);
+		memcpy(data + len, fr->buf, fr->pos);
+		len = flightrec_size;
+		/* The oldest line has been partially overwritten, skip it.  */
+		start = memchr(data, '\n', len);
+		start = start ? start + 1 : data + len;
+	} else {
+		start = data;
+	}
+	end = memrchr(start, '\n', data + len - start);
+	end = end ? end + 1 : start;
+
+	fwrite(start, 1, end - start, fr->dest);
+	fflush(fr->dest);
+
+	fr->pos = data + len - end;
+	memmove(fr->buf, end, fr->pos);
+	fr->wrapped = false;
+	if (data != fr->buf)
+		free(data);
+}
+
+/*
+ * Write the ring behind FP, or all rings if FP is NULL,
+ * to their destinations, and empty them.
+ */
+void
+flightrec_dump(FILE *fp)
+{
+	struct flightrec *fr;
+
+	for (fr = rings; fr; fr = fr->next) {
+		if (!fp || fr->fp == fp)
+			flightrec_write_out(fr);
+	}
+}
+
+/* Return true if the syscall TCP has just left should fire a dump.  */
+bool
+flightrec_syscall_trigger(struct tcb *tcp, const struct timespec *ts)
+{
+	unsigned int i;
+
+	if (flightrec_latency.tv_sec || flightrec_latency.tv_nsec) {
+		struct timespec dts;
+
+		ts_sub(&dts, ts, &tcp->etime);
+		if (ts_cmp(&dts, &flightrec_latency) >= 0)
+			return true;
+	}
+
+	if (!tcp->u_error)
+		return false;
+	for (i = 0; i < n_errno_triggers; ++i) {
+		const char *error = err_name(tcp->u_error);
+
+		if (error && strcmp(error, errno_triggers[i].error) == 0 &&
+		    strcmp(tcp->s_ent->sys_name,
+			   errno_triggers[i].syscall) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+is_errno_name(const char *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < nerrnos; ++i) {
+		if (errnoent[i] && strcmp(errnoent[i], s) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+is_syscall_name(const char *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < nsyscalls; ++i) {
+		if (sysent[i].sys_name && strcmp(sysent[i].sys_name, s) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Parse the argument of -R:
+ * SIZE[,signal][,latency=DURATION][,SYSCALL=ERRNO]...
+ * SIZE may have a K, M, or G suffix.
+ * Return 0 on success, -1 if ARG is not valid.
+ */
+int
+flightrec_option(const char *arg)
+{
+	char *copy = xstrdup(arg);
+	char *saveptr = NULL;
+	char *tok = strtok_r(copy, ",", &saveptr);
+	char *end;
+	unsigned long long size;
+
+	errno = 0;
+	size = tok ? strtoull(tok, &end, 10) : 0;
+	if (!tok || errno || end == tok)
+		return -1;
+	switch (*end) {
+	case 'G':
+		size <<= 10;
+		/* fall through */
+	case 'M':
+		size <<= 10;
+		/* fall through */
+	case 'K':
+		size <<= 10;
+		++end;
+	}
+	if (*end || !size || size > SIZE_MAX / 2)
+		return -1;
+	flightrec_size = size;
+
+	while ((tok = strtok_r(NULL, ",", &saveptr))) {
+		char *val = strchr(tok, '=');
+
+		if (strcmp(tok, "signal") == 0) {
+			flightrec_on_signal = true;
+			continue;
+		}
+		if (!val)
+			return -1;
+		*val++ = '\0';
+		if (strcmp(tok, "latency") == 0) {
+			if (parse_duration(val, &flightrec_latency) < 0)
+				return -1;
+		} else if (is_syscall_name(tok) && is_errno_name(val)) {
+			errno_triggers =
+				xreallocarray(errno_triggers,
+					      n_errno_triggers + 1,
+					      sizeof(*errno_triggers));
+			errno_triggers[n_errno_triggers].syscall = tok;
+			errno_triggers[n_errno_triggers].error = val;
+			++n_errno_triggers;
+		} else {
+			return -1;
+		}
+	}
+	/* copy is not freed, errno_triggers point into it.  */
+	return 0;
+}
+
+#else /* !HAVE_FOPENCOOKIE */
+
+size_t flightrec_size;
+bool flightrec_on_signal;
+struct timespec flightrec_latency;
+
+FILE *
+flightrec_fopen(FILE *dest)
+{
+	return dest;
+}
+
+void
+flightrec_dump(FILE *fp)
+{
+}
+
+bool
+flightrec_syscall_trigger(struct tcb *tcp, const struct timespec *ts)
+{
+	return false;
+}
+
+int
+flightrec_option(const char *arg)
+{
+	error_msg_and_die("-R is not supported by this build of strace");
+}
+
+#endif /* HAVE_FOPENCOOKIE */
@@ -52,6 +52,78 @@ static struct gdb_conn* gdb = NULL;
 static bool gdb_extended = false;
 static bool gdb_multiprocess = false;
 static bool gdb_vcont = false;
+static bool gdb_binary_read = false;
+
+/*
+ * Registers and memory of a stopped tracee cannot change until it is
+ * resumed, so everything fetched from the stub is cached until then.
+ * Each resumption starts a new generation, invalidating all entries.
+ */
+static unsigned int gdb_stop_generation = 1;
+
+/* Registers are cached per thread by gdb register number.  */
+#define GDB_MAX_REGS 64
+
+struct gdb_reg_cache {
+        pid_t tid;
+        unsigned int generation;
+        uint64_t valid; // bitmap of cached register numbers
+        uint64_t values[GDB_MAX_REGS];
+};
+
+static struct gdb_reg_cache *gdb_reg_caches;
+static size_t gdb_reg_caches_size;
+
+/* GDB_REGS_* kind of the stop registers are currently fetched for.  */
+static unsigned int gdb_regs_wanted = GDB_REGS_OTHER;
+/* QCatchSyscalls commands by personality, built on first use.  */
+static char *gdb_catch_syscalls_cmds[SUPPORTED_PERSONALITIES];
+
+/* Thread that g, p, m and x packets currently refer to, if known.  */
+static pid_t gdb_general_tid = -1;
+
+/* Cleared when the stub turns out not to support the p packet.  */
+static bool gdb_p_packet = true;
+
+static struct {
+        unsigned long expedited;
+        unsigned long p_packets;
+        unsigned long g_packets;
+} gdb_reg_stats;
+
+/*
+ * Memory is cached in aligned lines.  A line never crosses a page
+ * boundary, so it is either entirely readable or not at all.
+ */
+#define GDB_MEM_LINE_SIZE 256
+/* Maximum number of memory requests in flight in no-ack mode.  */
+#define GDB_MEM_PIPELINE 8
+/* The smallest page size of any Linux target.  */
+#define GDB_MEM_PAGE_SIZE 4096
+
+struct gdb_mem_line {
+        unsigned long addr;
+        pid_t tid;
+        unsigned int generation;
+        int error; // 0 once filled, errno on failure, -1 while pending
+        char data[GDB_MEM_LINE_SIZE];
+};
+
+static struct gdb_mem_line *gdb_mem_cache;
+static size_t gdb_mem_cache_size; // always a power of 2
+static size_t gdb_mem_cache_used;
+
+struct gdb_mem_request {
+        unsigned long addr;
+        unsigned int len;
+};
+
+static struct {
+        unsigned long requests;
+        unsigned long bytes;
+        unsigned long hits;
+        unsigned long misses;
+} gdb_mem_stats;
 
 static const char * const gdb_signal_names[] = {
 #define SET(symbol, constant, name, string) \
@@ -86,13 +158,14 @@ struct gdb_stop_reply {
         int tid; // thread id, aka kernel tid
 };
 
+static void gdb_invalidate_caches(void);
+
 static bool
 gdb_ok()
 {
         size_t size;
         char *reply = gdb_recv(gdb, &size, false);
         bool ok = size == 2 && !strcmp(reply, "OK");
-        free(reply);
         return ok;
 }
 
@@ -183,6 +256,54 @@ gdb_parse_thread(const char *id, int *pid, int *tid)
         }
 }
 
+/* Find the register cache of tid for the current stop, creating it if needed. */
+static struct gdb_reg_cache *
+gdb_reg_cache_get(pid_t tid)
+{
+        struct gdb_reg_cache *cache = NULL;
+        size_t i;
+
+        for (i = 0; i < gdb_reg_caches_size; ++i) {
+                struct gdb_reg_cache *c = &gdb_reg_caches[i];
+                if (c->generation != gdb_stop_generation) {
+                        if (!cache)
+                                cache = c;
+                } else if (c->tid == tid) {
+                        return c;
+                }
+        }
+
+        if (!cache) {
+                size_t old_size = gdb_reg_caches_size;
+
+                gdb_reg_caches_size = old_size ? old_size * 2 : 4;
+                gdb_reg_caches = xreallocarray(gdb_reg_caches,
+                                               gdb_reg_caches_size,
+                                               sizeof(gdb_reg_caches[0]));
+                memset(gdb_reg_caches + old_size, 0,
+                       (gdb_reg_caches_size - old_size) *
+                       sizeof(gdb_reg_caches[0]));
+                cache = &gdb_reg_caches[old_size];
+        }
+
+        cache->tid = tid;
+        cache->generation = gdb_stop_generation;
+        cache->valid = 0;
+        return cache;
+}
+
+static void
+gdb_reg_cache_store(struct gdb_reg_cache *cache, unsigned int regno,
+                    const char *hex, size_t len)
+{
+        // "xx..." means the register is unavailable
+        if (regno >= GDB_MAX_REGS || !len || hex[0] == 'x')
+                return;
+
+        cache->values[regno] = gdb_decode_hex_n(hex, len);
+        cache->valid |= 1ULL << regno;
+}
+
 static void
 gdb_recv_signal(struct gdb_stop_reply *stop)
 {
@@ -193,6 +314,13 @@ gdb_recv_signal(struct gdb_stop_reply *stop)
                         stop->code == GDB_SIGNAL_0)
                 ? gdb_stop_trap : gdb_stop_signal;
 
+        // expedited registers, stored once the thread is known
+        struct {
+                unsigned int regno;
+                const char *value;
+        } expedited[GDB_MAX_REGS];
+        unsigned int nexpedited = 0;
+
         // tokenize the n:r pairs
         char *info = strdupa(reply + 3);
         char *savetok = NULL, *nr;
@@ -203,7 +331,15 @@ gdb_recv_signal(struct gdb_stop_reply *stop)
                 if (!n || !r)
                         continue;
 
-                if (!strcmp(n, "thread")) {
+                if (n[strspn(n, "0123456789abcdefABCDEF")] == '\0') {
+                        if (nexpedited < ARRAY_SIZE(expedited)) {
+                                expedited[nexpedited].regno =
+                                        gdb_decode_hex_str(n);
+                                expedited[nexpedited].value = r;
+                                ++nexpedited;
+                        }
+                }
+                else if (!strcmp(n, "thread")) {
                         gdb_parse_thread(r, &stop->pid, &stop->tid);
                 }
                 else if (!strcmp(n, "syscall_entry")) {
@@ -220,6 +356,17 @@ gdb_recv_signal(struct gdb_stop_reply *stop)
                 }
         }
 
+        if (nexpedited && stop->tid > 0) {
+                struct gdb_reg_cache *cache = gdb_reg_cache_get(stop->tid);
+                unsigned int i;
+
+                for (i = 0; i < nexpedited; ++i)
+                        gdb_reg_cache_store(cache, expedited[i].regno,
+                                            expedited[i].value,
+                                            strlen(expedited[i].value));
+                gdb_reg_stats.expedited += nexpedited;
+        }
+
         // TODO guess architecture by the size of reported registers?
 }
 
@@ -242,8 +389,58 @@ gdb_recv_exit(struct gdb_stop_reply *stop)
         }
 }
 
+/* Receive a reply that has to outlive the next gdb_recv.  */
+static char *
+gdb_recv_copy(size_t *size, bool want_stop)
+{
+        char *reply = gdb_recv(gdb, size, want_stop);
+        char *copy = xmalloc(*size + 1);
+
+        memcpy(copy, reply, *size + 1);
+        return copy;
+}
+
+/*
+ * Acknowledge a non-stop notification.  The stub then reports each other
+ * pending stop in reply to another vStopped, which are queued, until OK.
+ */
+static void
+gdb_nonstop_drain(void)
+{
+        for (;;) {
+                static const char cmd[] = "vStopped";
+                gdb_send(gdb, cmd, sizeof(cmd) - 1);
+
+                size_t size;
+                char *reply = gdb_recv(gdb, &size, false);
+                if (size == 0 || !strcmp(reply, "OK"))
+                        break;
+                push_notification(reply, size);
+        }
+}
+
+/*
+ * In non-stop mode stops arrive as %Stop notifications, possibly while
+ * waiting for the reply to something else, so take the oldest queued
+ * stop first, or else wait for the next notification.
+ */
+static char *
+gdb_nonstop_next(size_t *size)
+{
+        if (gdb_clear_notified(gdb))
+                gdb_nonstop_drain();
+
+        char *reply = pop_notification(size);
+        if (!reply) {
+                reply = gdb_recv_copy(size, true);
+                if (gdb_clear_notified(gdb))
+                        gdb_nonstop_drain();
+        }
+        return reply;
+}
+
 static struct gdb_stop_reply
-gdb_recv_stop(struct gdb_stop_reply *stop_reply)
+gdb_recv_stop(void)
 {
         struct gdb_stop_reply stop = {
                 .reply = NULL,
@@ -254,55 +451,11 @@ gdb_recv_stop(struct gdb_stop_reply *stop_reply)
                 .pid = -1,
                 .tid = -1,
         };
-	char *reply = NULL;
-	size_t stop_size;
-
-
-	if (stop_reply)
-	    // pop_notification gave us a cached notification
-	    stop = *stop_reply;
-	else 
-	    stop.reply = gdb_recv(gdb, &stop.size, true);
-
-	if  (gdb_has_non_stop(gdb) && !stop_reply) {
-	    /* non-stop packet order:
-	       client sends: $vCont;c
-	       server sends: OK
-	       server sends: %Stop:T05syscall_entry (possibly out of order)
-	       client sends: $vStopped
-	       server possibly sends 0 or more: T05syscall_entry
-	       client sends to each: $vStopped
-	       server sends: OK
-	    */
-	     /* Do we have an out of order notification?  (see gdb_recv) */
-	     reply = pop_notification(&stop_size);
-	     if (reply) {
-		  if (debug_flag)
-		       printf ("popped %s\n", reply);
-		  stop.reply = reply;
-		  reply = gdb_recv(gdb, &stop_size, false); /* vContc OK */
-	     }
-	     else {
-		  if (stop.reply[0] == 'T') {
-		       reply = gdb_recv(gdb, &stop_size, false); /* vContc OK */
-		  }
-		  else {
-		       while (stop.reply[0] != 'T') 
-			    stop.reply = gdb_recv(gdb, &stop.size, true);
-		  }
-	     }
-
-	     if (stop.reply[0] == 'T') {
-		    do {
-			size_t this_size;
-			gdb_send(gdb,"vStopped",8);
-			reply = gdb_recv(gdb, &this_size, true);
-			if (strcmp (reply, "OK") == 0)
-			    break;
-			push_notification(reply, this_size);
-		    } while (true);
-	    }
-	} // gdb_has_non_stop
+
+        if (gdb_has_non_stop(gdb))
+                stop.reply = gdb_nonstop_next(&stop.size);
+        else
+                stop.reply = gdb_recv_copy(&stop.size, true);
 
         // all good packets are at least 3 bytes
         switch (stop.size >= 3 ? stop.reply[0] : 0) {
@@ -351,7 +504,30 @@ gdb_init()
         gdb_multiprocess = strstr(reply, "multiprocess+") != NULL;
         if (!gdb_multiprocess)
                 error_msg("couldn't enable gdb multiprocess mode");
-        free(reply);
+        gdb_binary_read = strstr(reply, "binary-upload+") != NULL;
+        const char *packet_size = strstr(reply, "PacketSize=");
+        if (packet_size) {
+                size_t val = gdb_decode_hex_str(packet_size + 11);
+                /* don't bother with anything smaller than the default */
+                if (val > GDB_DEFAULT_PACKET_SIZE)
+                        gdb_set_packet_size(gdb, val);
+        }
+        if (gdb_binary_read) {
+                /*
+                 * An empty reply to a zero-length read means the stub
+                 * doesn't know the x packet after all.  This is decided
+                 * once here: later on, an empty reply in the middle of a
+                 * pipelined batch is just a failed read.
+                 */
+                static const char x_cmd[] = "x0,0";
+                gdb_send(gdb, x_cmd, sizeof(x_cmd) - 1);
+                gdb_recv(gdb, &size, false);
+                gdb_binary_read = size != 0;
+        }
+        if (debug_flag)
+                error_msg("gdb packet size %zu, binary memory reads %s",
+                          gdb_packet_size(gdb),
+                          gdb_binary_read ? "enabled" : "disabled");
 
         static const char extended_cmd[] = "!";
         gdb_send(gdb, extended_cmd, sizeof(extended_cmd) - 1);
@@ -365,20 +541,82 @@ gdb_init()
         gdb_vcont = strncmp(reply, "vCont", 5) == 0;
         if (!gdb_vcont)
                 error_msg("gdb server doesn't support vCont");
-        free(reply);
+}
+
+/*
+ * Build the QCatchSyscalls command for a personality, listing only the
+ * syscalls selected by -e trace=, so that the stub doesn't even stop
+ * for the others.  Falls back to catching all syscalls if the list
+ * wouldn't fit in a packet.
+ */
+static const char *
+gdb_catch_syscalls_cmd(unsigned int personality)
+{
+        char **cmds = gdb_catch_syscalls_cmds;
+
+        if (cmds[personality])
+                return cmds[personality];
+
+        unsigned int count, i;
+        unsigned int *scnos = traced_scnos(personality, &count);
+        if (!scnos)
+                return cmds[personality] = xstrdup("QCatchSyscalls:1");
+        if (!count) {
+                free(scnos);
+                return cmds[personality] = xstrdup("QCatchSyscalls:0");
+        }
+
+        size_t max = gdb_packet_size(gdb) - 4;
+        char *cmd = xmalloc(max + 1);
+        size_t len = sprintf(cmd, "QCatchSyscalls:1");
+        for (i = 0; i < count; ++i) {
+                char num[sizeof(";ffffffff")];
+                size_t n = sprintf(num, ";%x", scnos[i]);
+                if (len + n > max) {
+                        len = sizeof("QCatchSyscalls:1") - 1;
+                        break;
+                }
+                memcpy(cmd + len, num, n);
+                len += n;
+        }
+        cmd[len] = '\0';
+        free(scnos);
+
+        if (debug_flag)
+                error_msg("gdb catching %s syscalls of personality %u",
+                          i < count ? "all" : "traced", personality);
+
+        return cmds[personality] = cmd;
 }
 
 static void
-gdb_init_syscalls()
+gdb_init_syscalls(struct tcb *tcp)
 {
-        static const char syscall_cmd[] = "QCatchSyscalls:1";
-        gdb_send(gdb, syscall_cmd, sizeof(syscall_cmd) - 1);
-        if (!gdb_ok())
-                error_msg("couldn't enable gdb syscall catching");
+#if SUPPORTED_PERSONALITIES > 1
+        const unsigned int personality = tcp->currpers;
+#else
+        const unsigned int personality = 0;
+#endif
+        const char *syscall_cmd = gdb_catch_syscalls_cmd(personality);
+
+        gdb_send(gdb, syscall_cmd, strlen(syscall_cmd));
+        if (gdb_ok())
+                return;
+
+        /* The stub may not accept a syscall list, catch everything.  */
+        static const char all_cmd[] = "QCatchSyscalls:1";
+        if (strcmp(syscall_cmd, all_cmd)) {
+                free(gdb_catch_syscalls_cmds[personality]);
+                gdb_catch_syscalls_cmds[personality] = xstrdup(all_cmd);
+                gdb_send(gdb, all_cmd, sizeof(all_cmd) - 1);
+                if (gdb_ok())
+                        return;
+        }
+        error_msg("couldn't enable gdb syscall catching");
 }
 
 static struct tcb*
-gdb_find_thread(int tid, bool current)
+gdb_find_thread(int pid, int tid, bool current)
 {
         if (tid < 0)
                 return NULL;
@@ -390,6 +628,14 @@ gdb_find_thread(int tid, bool current)
                 tcp->flags |= TCB_ATTACHED | TCB_STARTUP;
                 newoutf(tcp);
 
+                /*
+                 * Syscall catching is set per process, a new thread of
+                 * a known one is caught already.
+                 */
+                struct tcb *leader = pid != tid ? pid2tcb(pid) : NULL;
+                if (leader && leader->currpers == tcp->currpers)
+                        return tcp;
+
                 if (!current) {
                         char cmd[] = "Hgxxxxxxxx";
                         sprintf(cmd, "Hg%x", tid);
@@ -397,13 +643,46 @@ gdb_find_thread(int tid, bool current)
                         current = gdb_ok();
                         if (!current)
                                 error_msg("couldn't set gdb to thread %d", tid);
+                        gdb_general_tid = current ? tid : -1;
                 }
                 if (current)
-                        gdb_init_syscalls();
+                        gdb_init_syscalls(tcp);
         }
         return tcp;
 }
 
+/*
+ * Point the stub's general thread at tid.  In all-stop mode the stub
+ * does that itself for the thread that stopped, but in non-stop mode
+ * other threads keep running and stopping meanwhile.
+ */
+static void
+gdb_select_thread(pid_t tid)
+{
+        if (!gdb_has_non_stop(gdb) || tid == gdb_general_tid)
+                return;
+
+        char cmd[] = "Hgxxxxxxxx";
+        sprintf(cmd, "Hg%x", tid);
+        gdb_send(gdb, cmd, strlen(cmd));
+        if (gdb_ok())
+                gdb_general_tid = tid;
+        else
+                error_msg("couldn't set gdb to thread %d", tid);
+}
+
+/* Whether the stub still has any thread to trace.  */
+static bool
+gdb_has_threads(void)
+{
+        static const char cmd[] = "qfThreadInfo";
+        gdb_send(gdb, cmd, sizeof(cmd) - 1);
+
+        size_t size;
+        char *reply = gdb_recv(gdb, &size, false);
+        return size > 0 && reply[0] == 'm';
+}
+
 static void
 gdb_enumerate_threads()
 {
@@ -417,7 +696,7 @@ gdb_enumerate_threads()
         gdb_send(gdb, qfcmd, sizeof(qfcmd) - 1);
 
         size_t size;
-        char *reply = gdb_recv(gdb, &size, false);
+        char *reply = gdb_recv_copy(&size, false);
         while (reply[0] == 'm') {
                 char *thread;
                 for (thread = strtok(reply + 1, ","); thread;
@@ -425,7 +704,7 @@ gdb_enumerate_threads()
                         int pid, tid;
                         gdb_parse_thread(thread, &pid, &tid);
 
-                        struct tcb *tcp = gdb_find_thread(tid, false);
+                        struct tcb *tcp = gdb_find_thread(pid, tid, false);
                         if (tcp && !current_tcp)
                                 current_tcp = tcp;
                 }
@@ -434,7 +713,7 @@ gdb_enumerate_threads()
 
                 static const char qscmd[] = "qsThreadInfo";
                 gdb_send(gdb, qscmd, sizeof(qscmd) - 1);
-                reply = gdb_recv(gdb, &size, false);
+                reply = gdb_recv_copy(&size, false);
         }
 
         free(reply);
@@ -449,7 +728,19 @@ gdb_finalize_init()
 
         // Everything was stopped from startup_child/startup_attach,
         // now continue them all so the next reply will be a stop packet
-        if (gdb_vcont) {
+        gdb_invalidate_caches();
+        if (gdb_has_non_stop(gdb)) {
+                // the stops of the initial attach are stale once resumed
+                size_t size;
+                char *stale;
+                while ((stale = pop_notification(&size)))
+                        free(stale);
+
+                static const char cmd[] = "vCont;c";
+                gdb_send(gdb, cmd, sizeof(cmd) - 1);
+                if (!gdb_ok())
+                        error_msg("couldn't resume gdb threads");
+        } else if (gdb_vcont) {
                 static const char cmd[] = "vCont;c";
                 gdb_send(gdb, cmd, sizeof(cmd) - 1);
         } else {
@@ -461,9 +752,31 @@ gdb_finalize_init()
 void
 gdb_cleanup()
 {
+        if (gdb && debug_flag) {
+                error_msg("gdb memory reads: %lu requests, %lu bytes,"
+                          " %lu cache hits, %lu cache misses",
+                          gdb_mem_stats.requests, gdb_mem_stats.bytes,
+                          gdb_mem_stats.hits, gdb_mem_stats.misses);
+                error_msg("gdb register reads: %lu expedited,"
+                          " %lu p packets, %lu g packets",
+                          gdb_reg_stats.expedited, gdb_reg_stats.p_packets,
+                          gdb_reg_stats.g_packets);
+        }
         if (gdb)
                 gdb_end(gdb);
         gdb = NULL;
+        free(gdb_mem_cache);
+        gdb_mem_cache = NULL;
+        gdb_mem_cache_size = gdb_mem_cache_used = 0;
+        free(gdb_reg_caches);
+        gdb_reg_caches = NULL;
+        gdb_reg_caches_size = 0;
+
+        unsigned int p;
+        for (p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+                free(gdb_catch_syscalls_cmds[p]);
+                gdb_catch_syscalls_cmds[p] = NULL;
+        }
 }
 
 void
@@ -499,7 +812,7 @@ gdb_startup_child(char **argv)
         gdb_send(gdb, cmd, size);
         free(cmd);
 
-        struct gdb_stop_reply stop = gdb_recv_stop(NULL);
+        struct gdb_stop_reply stop = gdb_recv_stop();
         if (stop.size == 0)
                 error_msg_and_die("gdb server doesn't support vRun!");
         switch (stop.type) {
@@ -521,7 +834,7 @@ gdb_startup_child(char **argv)
 	struct tcb *tcp = alloctcb(tid);
         tcp->flags |= TCB_ATTACHED | TCB_STARTUP;
         newoutf(tcp);
-        gdb_init_syscalls();
+        gdb_init_syscalls(tcp);
 
         // TODO normal strace attaches right before exec, so the first syscall
         // seen is the execve with all its arguments.  Need to emulate that here?
@@ -538,7 +851,7 @@ gdb_startup_attach(struct tcb *tcp)
                 error_msg_and_die("gdb server doesn't support attaching processes!");
 
         char attach_cmd[] = "vAttach;XXXXXXXX";
-        struct gdb_stop_reply stop;
+        struct gdb_stop_reply stop = { .type = gdb_stop_unknown };
 	static const char nonstop_cmd[] = "QNonStop:1";
 
 	gdb_send(gdb, nonstop_cmd, sizeof(nonstop_cmd) - 1);
@@ -546,36 +859,43 @@ gdb_startup_attach(struct tcb *tcp)
 	       gdb_set_non_stop(gdb, true);
 
         sprintf(attach_cmd, "vAttach;%x", tcp->pid);
-        gdb_send(gdb, attach_cmd, strlen(attach_cmd));
 
-	do {
+	if (gdb_has_non_stop(gdb)) {
 		/*
 		  non-stop packet order:
+		  client sends: vAttach
+		  server sends: OK
+		  server sends: %Stop:T00thread:p...;
 		  client sends: vCont;t
 		  server sends: OK
-		  server sends: Stop:T05swbreak:;
+		  client sends: vStopped, server sends: T00thread:p...;
+		  ...
 		  client sends: vStopped
 		  server sends: OK
 		*/
-		char cmd[] = "vCont;t:pXXXXXXXX";
-		sprintf(cmd, "vCont;t:p%x.-1", tcp->pid);
-		if (!gdb_ok()) {
-                        stop.type = gdb_stop_unknown;
-                        break;
+		gdb_send(gdb, attach_cmd, strlen(attach_cmd));
+		if (gdb_ok()) {
+			char cmd[] = "vCont;t:pXXXXXXXX.-1";
+			sprintf(cmd, "vCont;t:p%x.-1", tcp->pid);
+			gdb_send(gdb, cmd, strlen(cmd));
+			if (gdb_ok())
+				stop = gdb_recv_stop();
 		}
-		gdb_send(gdb, cmd, strlen(cmd));
-		stop = gdb_recv_stop(NULL);
-	} while (0);
+		if (stop.type == gdb_stop_unknown)
+			free(stop.reply);
+	}
 	
 	if (stop.type == gdb_stop_unknown) {
-		static const char nonstop_cmd[] = "QNonStop:0";
-		gdb_send(gdb, nonstop_cmd, sizeof(nonstop_cmd) - 1);
-		if (gdb_ok())
-			gdb_set_non_stop(gdb, false);
-		else
-			error_msg_and_die("gdb server doesn't support vAttach!");
+		if (gdb_has_non_stop(gdb)) {
+			static const char allstop_cmd[] = "QNonStop:0";
+			gdb_send(gdb, allstop_cmd, sizeof(allstop_cmd) - 1);
+			if (gdb_ok())
+				gdb_set_non_stop(gdb, false);
+			else
+				error_msg_and_die("gdb server doesn't support vAttach!");
+		}
 		gdb_send(gdb, attach_cmd, strlen(attach_cmd));
-		stop = gdb_recv_stop(NULL);
+		stop = gdb_recv_stop();
 		if (stop.size == 0)
 			error_msg_and_die("gdb server doesn't support vAttach!");
 		switch (stop.type) {
@@ -603,7 +923,7 @@ gdb_startup_attach(struct tcb *tcp)
         }
         tcp->flags |= TCB_ATTACHED | TCB_STARTUP;
         newoutf(tcp);
-        gdb_init_syscalls();
+        gdb_init_syscalls(tcp);
 
         if (!qflag)
 		fprintf(stderr, "Process %u attached in %s mode\n", tcp->pid,
@@ -613,6 +933,8 @@ gdb_startup_attach(struct tcb *tcp)
 void
 gdb_detach(struct tcb *tcp)
 {
+        gdb_invalidate_caches();
+
         if (gdb_multiprocess) {
                 char cmd[] = "D;XXXXXXXX";
                 sprintf(cmd, "D;%x", tcp->pid);
@@ -643,138 +965,171 @@ gdb_trace()
         int gdb_sig = 0;
         pid_t tid;
 
-        stop = gdb_recv_stop(NULL);
-        do {
-                if (stop.size == 0)
-                        error_msg_and_die("gdb server gave an empty stop reply!?");
-                switch (stop.type) {
-                        case gdb_stop_unknown:
-                                error_msg_and_die("gdb server stop reply unknown: %.*s",
-                                                  (int)stop.size, stop.reply);
-                        case gdb_stop_error:
-                                // vCont error -> no more processes
-                                free(stop.reply);
-                                return false;
-                        default:
-                                break;
-                }
+        stop = gdb_recv_stop();
+        if (stop.size == 0)
+                error_msg_and_die("gdb server gave an empty stop reply!?");
+        switch (stop.type) {
+                case gdb_stop_unknown:
+                        error_msg_and_die("gdb server stop reply unknown: %.*s",
+                                          (int)stop.size, stop.reply);
+                case gdb_stop_error:
+                        // vCont error -> no more processes
+                        free(stop.reply);
+                        return false;
+                default:
+                        break;
+        }
 
-                tid = -1;
-                struct tcb *tcp = NULL;
+        tid = -1;
+        struct tcb *tcp = NULL;
 
-                if (gdb_multiprocess) {
-                        tid = stop.tid;
-                        tcp = gdb_find_thread(tid, true);
+        if (gdb_multiprocess) {
+                tid = stop.tid;
+                tcp = gdb_find_thread(stop.pid, tid, true);
+
+                /* Set current output file */
+                current_tcp = tcp;
+        } else if (current_tcp) {
+                tcp = current_tcp;
+                tid = tcp->pid;
+        }
 
-                        /* Set current output file */
-                        current_tcp = tcp;
-                } else if (current_tcp) {
-                        tcp = current_tcp;
-                        tid = tcp->pid;
-                }
+        if (tid < 0 || tcp == NULL)
+                error_msg_and_die("couldn't read tid from stop reply: %.*s",
+                                (int)stop.size, stop.reply);
 
-                if (tid < 0 || tcp == NULL)
-                        error_msg_and_die("couldn't read tid from stop reply: %.*s",
-                                        (int)stop.size, stop.reply);
+        bool exited = false;
+        switch (stop.type) {
+                case gdb_stop_exited:
+                        print_exited(tcp, tid, W_EXITCODE(stop.code, 0));
+                        droptcb(tcp);
+                        exited = true;
+                        break;
 
-                bool exited = false;
-                switch (stop.type) {
-                        case gdb_stop_exited:
-                                print_exited(tcp, tid, W_EXITCODE(stop.code, 0));
-                                droptcb(tcp);
-                                exited = true;
-                                break;
-
-                        case gdb_stop_terminated:
-                                print_signalled(tcp, tid, W_EXITCODE(0,
-                                                gdb_signal_to_target(tcp, stop.code)));
-                                droptcb(tcp);
-                                exited = true;
-                                break;
-
-                        default:
-                                break;
-                }
+                case gdb_stop_terminated:
+                        print_signalled(tcp, tid, W_EXITCODE(0,
+                                        gdb_signal_to_target(tcp, stop.code)));
+                        droptcb(tcp);
+                        exited = true;
+                        break;
 
-                if (exited && !gdb_multiprocess) {
-                        free(stop.reply);
-                        return false;
-                }
+                default:
+                        break;
+        }
 
-                get_regs(tid);
+        if (exited && !gdb_multiprocess) {
+                free(stop.reply);
+                return false;
+        }
 
-                // TODO need code equivalent to PTRACE_EVENT_EXEC?
+        if (exited && gdb_has_non_stop(gdb)) {
+                // nothing to resume, the other threads are still running
+                free(stop.reply);
+                return gdb_has_threads();
+        }
 
-                /* Is this the very first time we see this tracee stopped? */
-                if (tcp->flags & TCB_STARTUP) {
-                        tcp->flags &= ~TCB_STARTUP;
-                        if (get_scno(tcp) == 1)
-                                tcp->s_prev_ent = tcp->s_ent;
-                }
+        if (!gdb_has_non_stop(gdb))
+                gdb_general_tid = tid;
+
+        switch (stop.type) {
+                case gdb_stop_syscall_entry:
+                        gdb_regs_wanted = GDB_REGS_ENTRY;
+                        break;
+                case gdb_stop_syscall_return:
+                        gdb_regs_wanted = GDB_REGS_EXIT;
+                        break;
+                default:
+                        gdb_regs_wanted = GDB_REGS_OTHER;
+                        break;
+        }
+        /* get_scno() below needs the syscall number even at a return. */
+        if (tcp->flags & TCB_STARTUP)
+                gdb_regs_wanted |= GDB_REGS_ENTRY;
+        get_regs(tid);
+
+        // TODO need code equivalent to PTRACE_EVENT_EXEC?
+
+        /* Is this the very first time we see this tracee stopped? */
+        if (tcp->flags & TCB_STARTUP) {
+                tcp->flags &= ~TCB_STARTUP;
+                if (get_scno(tcp) == 1)
+                        tcp->s_prev_ent = tcp->s_ent;
+        }
+
+        // TODO cflag means we need to update tcp->dtime/stime
+        // usually through wait rusage, but how can we do it?
+
+        switch (stop.type) {
+                case gdb_stop_unknown:
+                case gdb_stop_error:
+                case gdb_stop_exited:
+                case gdb_stop_terminated:
+                        // already handled above
+                        break;
+
+                case gdb_stop_trap:
+                        // misc trap, nothing to do...
+                        break;
 
-                // TODO cflag means we need to update tcp->dtime/stime
-                // usually through wait rusage, but how can we do it?
-
-                switch (stop.type) {
-                        case gdb_stop_unknown:
-                        case gdb_stop_error:
-                        case gdb_stop_exited:
-                        case gdb_stop_terminated:
-                                // already handled above
-                                break;
-
-                        case gdb_stop_trap:
-                                // misc trap, nothing to do...
-                                break;
-
-                        case gdb_stop_syscall_entry:
-                                // If we thought we were already in a syscall -- missed
-                                // a return? -- skipping this report doesn't do much
-                                // good.  Might as well force it to be a new entry
-                                // regardless to sync up.
-                                tcp->flags &= ~TCB_INSYSCALL;
+                case gdb_stop_syscall_entry:
+                        // If we thought we were already in a syscall -- missed
+                        // a return? -- skipping this report doesn't do much
+                        // good.  Might as well force it to be a new entry
+                        // regardless to sync up.
+                        tcp->flags &= ~TCB_INSYSCALL;
+                        tcp->scno = stop.code;
+                        trace_syscall(tcp);
+                        break;
+
+                case gdb_stop_syscall_return:
+                        // If we missed the entry, recording a return will only
+                        // confuse things, so let's just report the good ones.
+                        if (exiting(tcp)) {
                                 tcp->scno = stop.code;
                                 trace_syscall(tcp);
-                                break;
-
-                        case gdb_stop_syscall_return:
-                                // If we missed the entry, recording a return will only
-                                // confuse things, so let's just report the good ones.
-                                if (exiting(tcp)) {
-                                        tcp->scno = stop.code;
-                                        trace_syscall(tcp);
-                                }
-                                break;
-
-                        case gdb_stop_signal:
-                                {
-                                        siginfo_t *si = NULL;
-                                        size_t siginfo_size;
-                                        char *siginfo_reply =
-                                                gdb_xfer_read(gdb, "siginfo", "", &siginfo_size);
-                                        if (siginfo_reply && siginfo_size == sizeof(siginfo_t))
-                                                si = (siginfo_t *) siginfo_reply;
-
-                                        // XXX gdbserver returns "native" siginfo of 32/64-bit target
-                                        // but strace expects its own format as PTRACE_GETSIGINFO
-                                        // would have given it.
-                                        // (i.e. need to reverse siginfo_fixup)
-                                        // ((i.e. siginfo_from_compat_siginfo))
-
-                                        gdb_sig = stop.code;
-                                        print_stopped(tcp, si, gdb_signal_to_target(tcp, gdb_sig));
-                                        free(siginfo_reply);
-                                }
-                                break;
-                }
+                        }
+                        break;
 
-                free(stop.reply);
-                stop.reply = pop_notification(&stop.size);
-                if (stop.reply) // cached out of order notification?
-                        stop = gdb_recv_stop(&stop);
-                else
+                case gdb_stop_signal:
+                        {
+                                siginfo_t *si = NULL;
+                                size_t siginfo_size;
+                                char *siginfo_reply =
+                                        gdb_xfer_read(gdb, "siginfo", "", &siginfo_size);
+                                if (siginfo_reply && siginfo_size == sizeof(siginfo_t))
+                                        si = (siginfo_t *) siginfo_reply;
+
+                                // XXX gdbserver returns "native" siginfo of 32/64-bit target
+                                // but strace expects its own format as PTRACE_GETSIGINFO
+                                // would have given it.
+                                // (i.e. need to reverse siginfo_fixup)
+                                // ((i.e. siginfo_from_compat_siginfo))
+
+                                gdb_sig = stop.code;
+                                print_stopped(tcp, si, gdb_signal_to_target(tcp, gdb_sig));
+                                free(siginfo_reply);
+                        }
                         break;
-        } while (true);
+        }
+
+        free(stop.reply);
+
+        gdb_invalidate_caches();
+
+        if (gdb_has_non_stop(gdb)) {
+                // only this thread stopped, so only this one is resumed
+                char cmd[] = "vCont;Cxx:pxxxxxxxx.xxxxxxxx";
+                int len = sprintf(cmd, gdb_sig ? "vCont;C%02x:" : "vCont;c:",
+                                  gdb_sig);
+                if (stop.pid > 0)
+                        sprintf(cmd + len, "p%x.%x", stop.pid, tid);
+                else
+                        sprintf(cmd + len, "%x", tid);
+                gdb_send(gdb, cmd, strlen(cmd));
+                // an error here means the thread is gone already
+                gdb_ok();
+                return true;
+        }
 
         if (gdb_sig) {
                 if (gdb_vcont) {
@@ -801,16 +1156,334 @@ gdb_trace()
         return true;
 }
 
-char *
-gdb_get_regs(pid_t tid, size_t *size)
+/* Fetch the registers in mask (a bitmap by register number) with p packets.  */
+static int
+gdb_fetch_regs_p(struct gdb_reg_cache *cache, uint64_t mask)
 {
-        if (!gdb)
-                return NULL;
+        const unsigned int window = gdb_has_noack(gdb) ? GDB_MAX_REGS : 1;
+        unsigned int sent = 0, received = 0, regno = 0;
+        unsigned int inflight[GDB_MAX_REGS];
+        int rc = 0;
+
+        while (received < sent || mask) {
+                while (mask && sent - received < window) {
+                        char cmd[] = "pxxxxxxxx";
+
+                        while (!(mask & (1ULL << regno)))
+                                ++regno;
+                        mask &= ~(1ULL << regno);
+                        sprintf(cmd, "p%x", regno);
+                        gdb_send(gdb, cmd, strlen(cmd));
+                        inflight[sent++ % GDB_MAX_REGS] = regno;
+                        ++gdb_reg_stats.p_packets;
+                }
+
+                size_t size;
+                char *reply = gdb_recv(gdb, &size, false);
+                unsigned int n = inflight[received++ % GDB_MAX_REGS];
+
+                if (size == 0) {
+                        /* unsupported, drain the rest and fall back to g */
+                        gdb_p_packet = false;
+                        rc = -1;
+                } else if (reply[0] == 'E') {
+                        rc = -1;
+                } else if (rc == 0) {
+                        gdb_reg_cache_store(cache, n, reply, size);
+                }
+                if (rc < 0)
+                        mask = 0;
+        }
+
+        return rc;
+}
 
-        /* NB: this assumes gdbserver's current thread is also tid.  If that
-         * may not be the case, we should send "HgTID" first, and restore.  */
+/* Fetch the registers described by regs with a g packet.  */
+static int
+gdb_fetch_regs_g(struct gdb_reg_cache *cache,
+                 const struct gdb_reg_desc *regs, size_t nregs)
+{
+        /* gdb_get_regs has made tid the stub's general thread.  */
         gdb_send(gdb, "g", 1);
-        return gdb_recv(gdb, size, false);
+        ++gdb_reg_stats.g_packets;
+
+        size_t size;
+        char *reply = gdb_recv(gdb, &size, false);
+        if (size == 0 || reply[0] == 'E')
+                return -1;
+
+        size_t i;
+        for (i = 0; i < nregs; ++i) {
+                size_t offset = 2 * regs[i].offset;
+                size_t len = 2 * regs[i].size;
+
+                if (offset + len <= size)
+                        gdb_reg_cache_store(cache, regs[i].regno,
+                                            reply + offset, len);
+        }
+        return 0;
+}
+
+/*
+ * Get the registers described by regs that are needed at the current stop,
+ * as raw hex-decoded values, like they appear in a g packet.  Registers
+ * expedited in the stop reply are taken from there, the rest are fetched
+ * with p packets, or with a single g packet if the stub has no p.
+ * On success, returns 0 and sets a bit in *fetched for each filled value.
+ */
+int
+gdb_get_regs(pid_t tid, const struct gdb_reg_desc *regs, size_t nregs,
+             uint64_t *values, unsigned long *fetched)
+{
+        if (!gdb)
+                return -1;
+
+        struct gdb_reg_cache *cache = gdb_reg_cache_get(tid);
+        gdb_select_thread(tid);
+        uint64_t wanted = 0;
+        size_t i;
+
+        for (i = 0; i < nregs; ++i)
+                if ((regs[i].stops & gdb_regs_wanted) &&
+                    regs[i].regno < GDB_MAX_REGS)
+                        wanted |= 1ULL << regs[i].regno;
+
+        uint64_t missing = wanted & ~cache->valid;
+        if (missing && gdb_p_packet)
+                gdb_fetch_regs_p(cache, missing);
+        missing = wanted & ~cache->valid;
+        if (missing && !gdb_p_packet)
+                gdb_fetch_regs_g(cache, regs, nregs);
+        if (wanted & ~cache->valid)
+                return -1;
+
+        *fetched = 0;
+        for (i = 0; i < nregs; ++i) {
+                if (wanted & (1ULL << regs[i].regno)) {
+                        values[i] = cache->values[regs[i].regno];
+                        *fetched |= 1UL << i;
+                }
+        }
+        return 0;
+}
+
+static void
+gdb_invalidate_caches(void)
+{
+        gdb_mem_cache_used = 0;
+        if (++gdb_stop_generation == 0) {
+                /* wrapped around, old generations are ambiguous now */
+                memset(gdb_mem_cache, 0,
+                       gdb_mem_cache_size * sizeof(gdb_mem_cache[0]));
+                memset(gdb_reg_caches, 0,
+                       gdb_reg_caches_size * sizeof(gdb_reg_caches[0]));
+                gdb_stop_generation = 1;
+        }
+}
+
+static size_t
+gdb_mem_hash(pid_t tid, unsigned long addr)
+{
+        return ((addr / GDB_MEM_LINE_SIZE) ^ ((unsigned long) tid * 0x9e3779b1))
+                & (gdb_mem_cache_size - 1);
+}
+
+/* Find the cache line of tid's memory at addr, or claim a free slot for it. */
+static struct gdb_mem_line *
+gdb_mem_lookup(pid_t tid, unsigned long addr)
+{
+        size_t i = gdb_mem_hash(tid, addr);
+
+        for (;; i = (i + 1) & (gdb_mem_cache_size - 1)) {
+                struct gdb_mem_line *line = &gdb_mem_cache[i];
+
+                if (line->generation != gdb_stop_generation) {
+                        line->generation = gdb_stop_generation;
+                        line->addr = addr;
+                        line->tid = tid;
+                        line->error = -1;
+                        ++gdb_mem_cache_used;
+                        return line;
+                }
+                if (line->addr == addr && line->tid == tid)
+                        return line;
+        }
+}
+
+/* Make room for another nlines lines, keeping the load factor below 1/2. */
+static void
+gdb_mem_cache_reserve(size_t nlines)
+{
+        size_t new_size = gdb_mem_cache_size ? gdb_mem_cache_size : 64;
+
+        while ((gdb_mem_cache_used + nlines) * 2 > new_size)
+                new_size *= 2;
+        if (new_size == gdb_mem_cache_size)
+                return;
+
+        struct gdb_mem_line *old_cache = gdb_mem_cache;
+        size_t old_size = gdb_mem_cache_size;
+        size_t i;
+
+        gdb_mem_cache = xcalloc(new_size, sizeof(gdb_mem_cache[0]));
+        gdb_mem_cache_size = new_size;
+        gdb_mem_cache_used = 0;
+        for (i = 0; i < old_size; ++i) {
+                if (old_cache[i].generation != gdb_stop_generation)
+                        continue;
+                struct gdb_mem_line *line =
+                        gdb_mem_lookup(old_cache[i].tid, old_cache[i].addr);
+                memcpy(line, &old_cache[i], sizeof(*line));
+        }
+        free(old_cache);
+}
+
+/* The largest memory request whose reply fits into a packet.  */
+static unsigned int
+gdb_mem_request_max(void)
+{
+        size_t packet_size = gdb_packet_size(gdb) - 1;
+        size_t max = gdb_binary_read ? packet_size : packet_size / 2;
+
+        max -= max % GDB_MEM_LINE_SIZE;
+        return max ? max : GDB_MEM_LINE_SIZE;
+}
+
+static void
+gdb_mem_send_request(const struct gdb_mem_request *req)
+{
+        char cmd[] = "xxxxxxxxxxxxxxxxx,xxxxxxxx";
+
+        sprintf(cmd, "%c%lx,%x", gdb_binary_read ? 'x' : 'm',
+                req->addr, req->len);
+        gdb_send(gdb, cmd, strlen(cmd));
+        ++gdb_mem_stats.requests;
+}
+
+/*
+ * Fill the lines covered by req from a reply.
+ * Returns the number of bytes stored, or -1 if the request failed.
+ */
+static int
+gdb_mem_recv_reply(pid_t tid, const struct gdb_mem_request *req)
+{
+        size_t size;
+        char *reply = gdb_recv(gdb, &size, false);
+        const char *data = reply;
+        unsigned int len;
+
+        if (gdb_binary_read) {
+                if (size == 0 || reply[0] != 'b')
+                        return -1;
+                ++data;
+                len = size - 1;
+        } else {
+                if (size < 2 || reply[0] == 'E' || (size & 1))
+                        return -1;
+                len = size / 2;
+        }
+        if (len > req->len)
+                len = req->len;
+        gdb_mem_stats.bytes += len;
+
+        /* only complete lines are of any use */
+        len -= len % GDB_MEM_LINE_SIZE;
+
+        unsigned int off;
+        for (off = 0; off < len; off += GDB_MEM_LINE_SIZE) {
+                struct gdb_mem_line *line =
+                        gdb_mem_lookup(tid, req->addr + off);
+                if (gdb_binary_read) {
+                        memcpy(line->data, data + off, GDB_MEM_LINE_SIZE);
+                } else if (gdb_decode_hex_buf(data + 2 * off,
+                                              2 * GDB_MEM_LINE_SIZE,
+                                              line->data) < 0)
+                        return -1;
+                line->error = 0;
+        }
+
+        return len;
+}
+
+/*
+ * Fetch the missing lines in [addr, addr + len) of tid's memory.
+ * Adjacent missing lines are coalesced into requests of up to the maximum
+ * packet size, and in no-ack mode up to GDB_MEM_PIPELINE requests are sent
+ * before waiting for the first reply.  Replies arrive in request order.
+ */
+static void
+gdb_mem_fetch(pid_t tid, unsigned long addr, unsigned long end)
+{
+        const unsigned int window = gdb_has_noack(gdb) ? GDB_MEM_PIPELINE : 1;
+        const unsigned int max = gdb_mem_request_max();
+        struct gdb_mem_request *queue = NULL;
+        size_t queue_size = 0, head = 0, tail = 0, sent = 0;
+
+        for (; addr < end; addr += GDB_MEM_LINE_SIZE) {
+                struct gdb_mem_line *line = gdb_mem_lookup(tid, addr);
+                if (line->error != -1) {
+                        ++gdb_mem_stats.hits;
+                        continue;
+                }
+                ++gdb_mem_stats.misses;
+
+                if (tail > head) {
+                        struct gdb_mem_request *last = &queue[tail - 1];
+                        if (last->addr + last->len == addr &&
+                            last->len + GDB_MEM_LINE_SIZE <= max) {
+                                last->len += GDB_MEM_LINE_SIZE;
+                                continue;
+                        }
+                }
+                if (tail == queue_size) {
+                        queue_size = queue_size ? queue_size * 2 : 8;
+                        queue = xreallocarray(queue, queue_size,
+                                              sizeof(queue[0]));
+                }
+                queue[tail].addr = addr;
+                queue[tail].len = GDB_MEM_LINE_SIZE;
+                ++tail;
+        }
+
+        while (head < tail) {
+                while (sent < tail && sent - head < window)
+                        gdb_mem_send_request(&queue[sent++]);
+
+                struct gdb_mem_request req = queue[head++];
+                int len = gdb_mem_recv_reply(tid, &req);
+
+                struct gdb_mem_request rest = {
+                        .addr = req.addr + (len > 0 ? len : 0),
+                        .len = req.len - (len > 0 ? len : 0),
+                };
+                if (!rest.len)
+                        continue;
+
+                if (req.len == GDB_MEM_LINE_SIZE) {
+                        gdb_mem_lookup(tid, req.addr)->error = EINVAL;
+                        continue;
+                }
+
+                /*
+                 * A short reply or an error of a multi-line request:
+                 * the request may have run into an unreadable page,
+                 * so retry the rest of it line by line.
+                 */
+                unsigned int nlines = rest.len / GDB_MEM_LINE_SIZE;
+                if (tail + nlines > queue_size) {
+                        queue_size = tail + nlines;
+                        queue = xreallocarray(queue, queue_size,
+                                              sizeof(queue[0]));
+                }
+                for (; rest.len; rest.len -= GDB_MEM_LINE_SIZE) {
+                        queue[tail].addr = rest.addr;
+                        queue[tail].len = GDB_MEM_LINE_SIZE;
+                        rest.addr += GDB_MEM_LINE_SIZE;
+                        ++tail;
+                }
+        }
+
+        free(queue);
 }
 
 int
@@ -820,30 +1493,54 @@ gdb_read_mem(pid_t tid, long addr, unsigned int len, bool check_nil, char *out)
                 errno = EINVAL;
                 return -1;
         }
+        if (!len)
+                return 0;
 
-        /* NB: this assumes gdbserver's current thread is also tid.  If that
-         * may not be the case, we should send "HgTID" first, and restore.  */
-        while (len) {
-                char cmd[] = "mxxxxxxxxxxxxxxxx,xxxx";
-                unsigned int chunk_len = len < 0x1000 ? len : 0x1000;
-                sprintf(cmd, "m%lx,%x", addr, chunk_len);
-                gdb_send(gdb, cmd, strlen(cmd));
+        gdb_select_thread(tid);
+
+        const unsigned long start = (unsigned long) addr;
+        const unsigned long first = start - start % GDB_MEM_LINE_SIZE;
+        const unsigned long end = start + len;
+        const unsigned long last = end + (GDB_MEM_LINE_SIZE - 1 -
+                                          (end - 1) % GDB_MEM_LINE_SIZE);
+
+        unsigned long fetched = first;
+        unsigned long line_addr;
+
+        gdb_mem_cache_reserve((last - first) / GDB_MEM_LINE_SIZE);
+        for (line_addr = first; line_addr < last;
+             line_addr += GDB_MEM_LINE_SIZE) {
+                if (line_addr == fetched) {
+                        /*
+                         * A string is likely to end long before len,
+                         * and the page after it may not be readable,
+                         * so fetch it a page at a time.
+                         */
+                        fetched = last;
+                        if (check_nil) {
+                                unsigned long page_end = line_addr -
+                                        line_addr % GDB_MEM_PAGE_SIZE +
+                                        GDB_MEM_PAGE_SIZE;
+                                fetched = MIN(last, page_end);
+                        }
+                        gdb_mem_fetch(tid, line_addr, fetched);
+                }
 
-                size_t size;
-                char *reply = gdb_recv(gdb, &size, false);
-                if (size < 2 || reply[0] == 'E' || size > len * 2
-                    || gdb_decode_hex_buf(reply, size, out) < 0) {
+                const struct gdb_mem_line *line =
+                        gdb_mem_lookup(tid, line_addr);
+                if (line->error) {
                         errno = EINVAL;
                         return -1;
                 }
 
-                chunk_len = size / 2;
+                unsigned long from = MAX(start, line_addr);
+                unsigned long to = MIN(end, line_addr + GDB_MEM_LINE_SIZE);
+                unsigned int chunk_len = to - from;
+
+                memcpy(out, line->data + (from - line_addr), chunk_len);
                 if (check_nil && strnlen(out, chunk_len) < chunk_len)
                         return 1;
-
-                addr += chunk_len;
                 out += chunk_len;
-                len -= chunk_len;
         }
 
         return 0;
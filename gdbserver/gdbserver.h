@@ -38,6 +38,21 @@ void gdb_detach(struct tcb *tcp);
 void gdb_startup_child(char **argv);
 void gdb_startup_attach(struct tcb *tcp);
 bool gdb_trace(void);
-char *gdb_get_regs(pid_t tid, size_t *size);
+/* Stops a register is needed at, see gdb_get_regs.  */
+#define GDB_REGS_ENTRY  1 /* syscall entry */
+#define GDB_REGS_EXIT   2 /* syscall return */
+#define GDB_REGS_OTHER  4 /* signals and other traps */
+#define GDB_REGS_ALL    (GDB_REGS_ENTRY | GDB_REGS_EXIT | GDB_REGS_OTHER)
+
+/* A register as described by the target's gdb feature XML.  */
+struct gdb_reg_desc {
+        unsigned int regno;  /* gdb register number */
+        unsigned int offset; /* offset in the g packet, in bytes */
+        unsigned int size;   /* in bytes */
+        unsigned int stops;  /* GDB_REGS_* */
+};
+
+int gdb_get_regs(pid_t tid, const struct gdb_reg_desc *regs, size_t nregs,
+                 uint64_t *values, unsigned long *fetched);
 int gdb_read_mem(pid_t tid, long addr, unsigned int len, bool check_nil, char *out);
 int gdb_getfdpath(pid_t tid, int fd, char *buf, unsigned bufsize);
@@ -29,6 +29,7 @@
 
 #define _GNU_SOURCE 1
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <signal.h>
@@ -43,6 +44,7 @@
 #include <arpa/inet.h>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -52,16 +54,39 @@
 #include "protocol.h"
 #include "defs.h"
 
+/* Size of the buffer data is read from the stub into.  */
+#define GDB_RECV_BUFFER_SIZE 0x4000
+
 struct gdb_conn {
-    FILE *in;
-    FILE *out;
+    int fd;
     bool ack;
     bool non_stop;
+    bool notified; // a notification arrived, see gdb_clear_notified
+    size_t packet_size;
+
+    // received data not consumed yet is in_buf[in_start, in_end)
+    char *in_buf;
+    size_t in_start;
+    size_t in_end;
+
+    // decoded reply, reused by every gdb_recv
+    char *reply;
+    size_t reply_size;
+
+    // framed packet, reused by every gdb_send
+    char *out_buf;
+    size_t out_size;
 };
 
-// non-stop notifications (see gdb_recv_stop)
-static char** notifications;
-static int notifications_size;
+// non-stop notifications (see push_notification)
+struct notification {
+    char *packet;
+    size_t size;
+};
+static struct notification *notifications;
+static size_t notifications_size;
+static size_t notifications_head;
+static size_t notifications_count;
 
 
 void
@@ -163,6 +188,8 @@ int gdb_decode_hex_buf(const char *bytes, size_t n, char *out)
 }
 
 
+static void send_raw(struct gdb_conn *conn, const char *data, size_t size);
+
 static struct gdb_conn *
 gdb_begin(int fd)
 {
@@ -170,26 +197,16 @@ gdb_begin(int fd)
     if (conn == NULL)
         err(1, "calloc");
 
+    conn->fd = fd;
     conn->ack = true;
+    conn->packet_size = GDB_DEFAULT_PACKET_SIZE;
 
-    // duplicate the handle to separate read/write state
-    int fd2 = dup(fd);
-    if (fd2 < 0)
-        err(1, "dup");
-
-    // open a FILE* for reading
-    conn->in = fdopen(fd, "rb");
-    if (conn->in == NULL)
-        err(1, "fdopen");
-
-    // open a FILE* for writing
-    conn->out = fdopen(fd2, "wb");
-    if (conn->out == NULL)
-        err(1, "fdopen");
+    conn->in_buf = malloc(GDB_RECV_BUFFER_SIZE);
+    if (conn->in_buf == NULL)
+        err(1, "malloc");
 
     // reset line state by acking any earlier input
-    fputc('+', conn->out);
-    fflush(conn->out);
+    send_raw(conn, "+", 1);
 
     return conn;
 }
@@ -264,8 +281,13 @@ gdb_begin_tcp(const char *node, const char *service)
         if (fd < 0)
             continue;
 
-        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            // every packet goes out with a single write, so don't let
+            // Nagle hold back the next one while the last is unacked
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
             break;
+        }
 
         close(fd);
         fd = -1;
@@ -294,15 +316,42 @@ gdb_begin_path(const char *path)
 void
 gdb_end(struct gdb_conn *conn)
 {
-    fclose(conn->in);
-    fclose(conn->out);
+    close(conn->fd);
+    free(conn->in_buf);
+    free(conn->reply);
+    free(conn->out_buf);
     free(conn);
 }
 
 
 static void
-send_packet(FILE *out, const char *command, size_t size)
+send_raw(struct gdb_conn *conn, const char *data, size_t size)
 {
+    while (size) {
+        ssize_t n = write(conn->fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EPIPE)
+                errx(0, "send: Connection closed");
+            err(1, "send");
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+static void
+send_packet(struct gdb_conn *conn, const char *command, size_t size)
+{
+    // frame the whole packet, so that it goes out with a single write
+    if (size + 4 > conn->out_size) {
+        conn->out_size = size + 4;
+        conn->out_buf = realloc(conn->out_buf, conn->out_size);
+        if (conn->out_buf == NULL)
+            err(1, "realloc");
+    }
+
     // compute the checksum -- simple mod256 addition
     size_t i;
     uint8_t sum = 0;
@@ -314,16 +363,51 @@ send_packet(FILE *out, const char *command, size_t size)
     // So just write raw here, and maybe let higher levels escape/RLE.
 
     if (debug_flag)
-      printf("\tSending packet: $%s\n", command);
-    fputc('$', out); // packet start
-    fwrite(command, 1, size, out); // payload
-    fprintf(out, "#%02x", sum); // packet end, checksum
-    fflush(out);
+      printf("\tSending packet: $%.*s\n", (int) size, command);
+
+    char *out = conn->out_buf;
+    *out++ = '$'; // packet start
+    memcpy(out, command, size); // payload
+    out += size;
+    *out++ = '#'; // packet end, checksum
+    gdb_encode_hex(sum, out);
+    out += 2;
+
+    send_raw(conn, conn->out_buf, out - conn->out_buf);
+}
+
+/* Refill the receive buffer, which must have been consumed entirely.  */
+static void
+recv_fill(struct gdb_conn *conn)
+{
+    ssize_t n;
+    do {
+        n = read(conn->fd, conn->in_buf, GDB_RECV_BUFFER_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        err(1, "recv");
+    else if (n == 0)
+        errx(0, "recv: Connection closed");
+
+    conn->in_start = 0;
+    conn->in_end = n;
+}
 
-    if (ferror(out))
-        err(1, "send");
-    else if (feof(out))
-        errx(0, "send: Connection closed");
+static inline uint8_t
+recv_char(struct gdb_conn *conn)
+{
+    if (conn->in_start == conn->in_end)
+        recv_fill(conn);
+    return conn->in_buf[conn->in_start++];
+}
+
+static inline uint8_t
+recv_peek(struct gdb_conn *conn)
+{
+    if (conn->in_start == conn->in_end)
+        recv_fill(conn);
+    return conn->in_buf[conn->in_start];
 }
 
 void
@@ -331,158 +415,170 @@ gdb_send(struct gdb_conn *conn, const char *command, size_t size)
 {
     bool acked = false;
     do {
-        send_packet(conn->out, command, size);
+        send_packet(conn, command, size);
 
         if (!conn->ack)
             break;
 
         // look for '+' ACK or '-' NACK/resend
-        acked = fgetc_unlocked(conn->in) == '+';
+        acked = recv_char(conn) == '+';
     } while (!acked);
 }
 
 
-/* push_notification/pop_notification caches notifications which
-   arrive via the following dialogue:
-   [ server: %Stop:T05syscall_entry...
-     client: $vStopped ]*
-     server: OK
+/* push_notification/pop_notification queue the stop replies which
+   arrive via the following dialogue, in the order they arrived:
+   server: %Stop:T05syscall_entry...
+   [ client: $vStopped
+     server: T05syscall_entry... ]*
+   client: $vStopped
+   server: OK
 */
 
 void
-push_notification(char *packet, size_t packet_size)
-{
-     int idx;
-
-     if (strncmp(packet+3, "syscall", 7) != 0)
-	 return;
-
-     if (notifications_size == 0) {
-	 notifications_size = 10;
-	 notifications = malloc(sizeof(void*) * notifications_size);
-	 memset(notifications, 0, sizeof(void*) * notifications_size);
-     }
-	  
-     while (true) {
-	 for (idx = 0; idx < notifications_size; idx++) {
-	     if (notifications[idx] == NULL)
-		  break;
-	 }
-	 if (idx == notifications_size) {
-	     notifications_size *= 2;
-	     notifications = realloc(notifications, sizeof(void*) * notifications_size);
-	 }
-	 else {
-	     notifications[idx] = malloc(packet_size);
-	     memcpy(notifications[idx], packet, packet_size);
-	     break;
-	 }
-     }
-}
+push_notification(const char *packet, size_t packet_size)
+{
+    if (notifications_count == notifications_size) {
+        // grow, and unwrap the ring into the new space
+        size_t old_size = notifications_size;
+        notifications_size = old_size ? old_size * 2 : 16;
+        notifications = realloc(notifications,
+                sizeof(notifications[0]) * notifications_size);
+        if (notifications == NULL)
+            err(1, "realloc");
+        memcpy(notifications + old_size, notifications,
+                sizeof(notifications[0]) * notifications_head);
+    }
 
+    struct notification *n = &notifications[
+        (notifications_head + notifications_count) % notifications_size];
+    n->packet = malloc(packet_size + 1);
+    if (n->packet == NULL)
+        err(1, "malloc");
+    memcpy(n->packet, packet, packet_size);
+    n->packet[packet_size] = '\0';
+    n->size = packet_size;
+    ++notifications_count;
+}
 
 char*
 pop_notification(size_t *size)
 {
-     int idx;
-     char *notification;
+    *size = 0;
+    if (!notifications_count)
+        return NULL;
 
-     *size = 0;
-     for (idx = 0; idx < notifications_size; idx++) {
-	 if (notifications[idx] != NULL)
-	      break;
-     }
+    struct notification *n = &notifications[notifications_head];
+    notifications_head = (notifications_head + 1) % notifications_size;
+    --notifications_count;
 
-     if (idx == notifications_size)
-	 return NULL;
-
-     notification = notifications[idx];
-     notifications[idx] = NULL;
-     *size = strlen(notification);
-     return notification;
+    *size = n->size;
+    return n->packet;
 }
 
 
-void
-dump_notifications(char *packet, int pid, int tid)
+/* Make room for at least size bytes, plus a terminating NUL, in the reply.  */
+static inline void
+reply_reserve(struct gdb_conn *conn, size_t size)
 {
-     int idx;
-
-     for (idx = 0; idx < notifications_size; idx++) {
-	 if (notifications[idx] != NULL)
-	     printf ("Notify Dump: %s\n", notifications[idx]);
-     }
+    if (size < conn->reply_size)
+        return;
+
+    size_t new_size = conn->reply_size ? conn->reply_size : 4096;
+    while (new_size <= size)
+        new_size *= 2;
+    conn->reply = realloc(conn->reply, new_size);
+    if (conn->reply == NULL)
+        err(1, "realloc");
+    conn->reply_size = new_size;
 }
 
-
+/* Decode the next packet straight out of the receive buffer into the
+ * connection's reply buffer, which is overwritten by the next call.  */
 static char *
-recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok)
+recv_packet(struct gdb_conn *conn, size_t *ret_size, bool* ret_sum_ok,
+            bool *ret_notify)
 {
     size_t i = 0;
-    size_t size = 4096;
-    char *reply = malloc(size);
-    if (reply == NULL)
-        err(1, "malloc");
-
-    int c;
+    uint8_t c;
     uint8_t sum = 0;
-    bool escape = false;
 
     // fast-forward to the first start of packet
-    while ((c = fgetc_unlocked(in)) != EOF && (c != '$' && c != '%'));
-    if (c == '%')
-      ungetc (c, in);
+    do {
+        if (conn->in_start == conn->in_end)
+            recv_fill(conn);
+        const char *start = conn->in_buf + conn->in_start;
+        const char *p = memchr(start, '$', conn->in_end - conn->in_start);
+        const char *q = memchr(start, '%', (p ?: conn->in_buf + conn->in_end)
+                                           - start);
+        if (q)
+            p = q;
+        conn->in_start = p ? (size_t) (p - conn->in_buf) : conn->in_end;
+    } while (conn->in_start == conn->in_end);
+    c = recv_char(conn);
+
+    // A notification is only recognized at the start of a packet:
+    // binary payloads (x and qXfer replies) may carry a literal '%'.
+    *ret_notify = c == '%';
+    if (c == '%') {
+        char pcr[5];
+
+        int idx = 0;
+        for (idx = 0; idx < 5; idx++) {
+            pcr[idx] = recv_char(conn);
+            sum += (uint8_t)pcr[idx];
+        }
+        if (strncmp(pcr, "Stop:", 5) != 0)
+            errx(1, "unknown non stop packet");
+    }
+
+    for (;;) {
+        // copy a run of plain characters at once
+        const uint8_t *run = (uint8_t *) conn->in_buf + conn->in_start;
+        const uint8_t *end = (uint8_t *) conn->in_buf + conn->in_end;
+        const uint8_t *p;
+        for (p = run; p < end; ++p) {
+            if (*p == '$' || *p == '#' || *p == '}' || *p == '*')
+                break;
+            sum += *p;
+        }
+        if (p > run) {
+            reply_reserve(conn, i + (p - run));
+            memcpy(conn->reply + i, run, p - run);
+            i += p - run;
+            conn->in_start += p - run;
+        }
 
-    while ((c = fgetc_unlocked(in)) != EOF) {
-        sum += (uint8_t)c;
+        c = recv_char(conn);
+        sum += c;
         switch (c) {
             case '$': // new packet?  start over...
                 i = 0;
                 sum = 0;
-                escape = false;
+                *ret_notify = false;
                 continue;
-	    case '%': 
-	      {
-		char pcr[6];
-
-		int idx = 0;
-
-                i = 0;
-                sum = 0;
-                escape = false;
-		for (idx = 0; idx < 5; idx++)
-		  {
-		    pcr[idx] = fgetc_unlocked(in);
-		    sum += (uint8_t)pcr[idx];
-		  }
-		if (strncmp(pcr, "Stop:", 5) == 0)
-		  continue;
-		errx (1,"unknown non stop packet");
-	      }
             case '#': // end of packet
                 sum -= c; // not part of the checksum
                 {
-                    uint8_t msb = fgetc_unlocked(in);
-                    uint8_t lsb = fgetc_unlocked(in);
+                    uint8_t msb = recv_char(conn);
+                    uint8_t lsb = recv_char(conn);
                     *ret_sum_ok = sum == gdb_decode_hex(msb, lsb);
                 }
                 *ret_size = i;
 
                 // terminate it for good measure
-                if (i == size) {
-                    reply = realloc(reply, size + 1);
-                    if (reply == NULL)
-                        err(1, "realloc");
-                }
-                reply[i] = '\0';
+                reply_reserve(conn, i);
+                conn->reply[i] = '\0';
 
 		if (debug_flag)
-		    printf("\tPacket received: %s\n", reply);
-                return reply;
+		    printf("\tPacket received: %s\n", conn->reply);
+                return conn->reply;
 
             case '}': // escape: next char is XOR 0x20
-                escape = true;
-                continue;
+                c = recv_char(conn);
+                sum += c;
+                c ^= 0x20;
+                break;
 
             case '*': // run-length-encoding
                 // The next character tells how many times to repeat the last
@@ -491,87 +587,74 @@ recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok)
                 // The count character can't be >126 or '$'/'#' packet markers.
 
                 if (i > 0) { // need something to repeat!
-                    int c2 = fgetc_unlocked(in);
+                    uint8_t c2 = recv_peek(conn);
                     if (c2 < 29 || c2 > 126 || c2 == '$' || c2 == '#') {
                         // invalid count character!
-                        ungetc(c2, in);
-                    } else {
-                        int count = c2 - 29;
-
-                        // get a bigger buffer if needed
-                        if (i + count > size) {
-                            size *= 2;
-                            reply = realloc(reply, size);
-                            if (reply == NULL)
-                                err(1, "realloc");
-                        }
-
-                        // fill the repeated character
-                        memset(&reply[i], reply[i - 1], count);
-                        i += count;
-                        sum += c2;
-                        continue;
+                        break;
                     }
-                }
-        }
+                    ++conn->in_start;
 
-        // XOR an escaped character
-        if (escape) {
-            c ^= 0x20;
-            escape = false;
-        }
-        
-        // get a bigger buffer if needed
-        if (i == size) {
-            size *= 2;
-            reply = realloc(reply, size);
-            if (reply == NULL)
-                err(1, "realloc");
+                    int count = c2 - 29;
+                    reply_reserve(conn, i + count);
+
+                    // fill the repeated character
+                    memset(&conn->reply[i], conn->reply[i - 1], count);
+                    i += count;
+                    sum += c2;
+                    continue;
+                }
+                break;
         }
 
         // add one character
-        reply[i++] = c;
+        reply_reserve(conn, i + 1);
+        conn->reply[i++] = c;
     }
-
-    if (ferror(in))
-        err(1, "recv");
-    else if (feof(in))
-        errx(0, "recv: Connection closed");
-    else
-        errx(1, "recv: Unknown connection error");
 }
 
+/* Receive a reply, which stays valid until the next gdb_recv.
+ * Unless want_stop, notifications are queued for pop_notification.  */
 char *
 gdb_recv(struct gdb_conn *conn, size_t *size, bool want_stop)
 {
     char *reply;
     bool acked = false;
+    bool notify;
     
     do {
-        reply = recv_packet(conn->in, size, &acked);
-
-	/* (See gdb_recv_stop for non-stop packet order) 
-	   If a notification arrived while expecting another packet 
-	   type, then cache the notification. */
-	if (! want_stop && strncmp (reply, "T05syscall", 10) == 0) {
-	    push_notification(reply, *size);
-	    if (debug_flag)
-	        printf ("Pushed %s\n", reply);
-	    reply = recv_packet(conn->in, size, &acked);
-	  }
+        reply = recv_packet(conn, size, &acked, &notify);
+
+        if (notify) {
+            // notifications are never acked, just remembered
+            conn->notified = true;
+            if (want_stop)
+                break;
+            push_notification(reply, *size);
+            if (debug_flag)
+                printf("\tQueued notification: %s\n", reply);
+            acked = false;
+            continue;
+        }
 
         if (conn->ack) {
             // send +/- depending on checksum result, retry if needed
-            fputc(acked ? '+' : '-', conn->out);
-            fflush(conn->out);
-            if (!acked)
-                free(reply);
+            send_raw(conn, acked ? "+" : "-", 1);
         }
-    } while (conn->ack && !acked);
+    } while (notify || (conn->ack && !acked));
 
     return reply;
 }
 
+/* Whether a notification arrived since the last call, meaning the stub
+ * waits for vStopped before it reports any further stops.  */
+bool
+gdb_clear_notified(struct gdb_conn *conn)
+{
+    bool notified = conn->notified;
+    conn->notified = false;
+    return notified;
+}
+
 bool
 gdb_start_noack(struct gdb_conn *conn)
 {
@@ -581,13 +664,30 @@ gdb_start_noack(struct gdb_conn *conn)
     size_t size;
     char *reply = gdb_recv(conn, &size, false);
     bool ok = size == 2 && !strcmp(reply, "OK");
-    free(reply);
 
     if (ok)
         conn->ack = false;
     return ok ? "OK" : "";
 }
 
+bool
+gdb_has_noack(struct gdb_conn *conn)
+{
+    return !conn->ack;
+}
+
+void
+gdb_set_packet_size(struct gdb_conn *conn, size_t size)
+{
+    conn->packet_size = size;
+}
+
+size_t
+gdb_packet_size(struct gdb_conn *conn)
+{
+    return conn->packet_size;
+}
+
 void
 gdb_set_non_stop(struct gdb_conn *conn, bool val)
 {
@@ -612,8 +712,9 @@ gdb_xfer_read(struct gdb_conn *conn,
     char *data = NULL;
     do {
         char *cmd;
-        int cmd_size = asprintf(&cmd, "qXfer:%s:read:%s:%zx,%x",
-                object ?: "", annex ?: "", offset, 0xfff /* XXX PacketSize */);
+        // leave room for the 'm'/'l' prefix of the reply
+        int cmd_size = asprintf(&cmd, "qXfer:%s:read:%s:%zx,%zx",
+                object ?: "", annex ?: "", offset, conn->packet_size - 2);
         if (cmd_size < 0) {
             break;
         }
@@ -629,7 +730,6 @@ gdb_xfer_read(struct gdb_conn *conn,
             case 'l':
                 data = realloc(data, offset + size - 1);
                 memcpy(data + offset, reply + 1, size - 1);
-                free(reply);
                 offset += size - 1;
                 if (c == 'l') {
                     *ret_size = offset;
@@ -640,7 +740,6 @@ gdb_xfer_read(struct gdb_conn *conn,
                 error = gdb_decode_hex_str(reply + 1);
                 break;
         }
-        free(reply);
         break;
     } while (0);
 
@@ -712,6 +811,5 @@ gdb_readlink(struct gdb_conn *conn, const char *linkpath,
         buf[data_len] = 0;
         ret = data_len;
     }
-    free(res.reply);
     return ret;
 }
@@ -33,6 +33,9 @@
 
 struct gdb_conn;
 
+/* Assumed until qSupported reports the stub's PacketSize.  */
+#define GDB_DEFAULT_PACKET_SIZE 0x2001
+
 void gdb_encode_hex(uint8_t byte, char *out);
 uint16_t gdb_decode_hex(char msb, char lsb);
 uint64_t gdb_decode_hex_n(const char *bytes, size_t n);
@@ -47,17 +50,26 @@ void gdb_end(struct gdb_conn *conn);
 
 void gdb_send(struct gdb_conn *conn, const char *command, size_t size);
 
+/* The reply is owned by conn and overwritten by the next gdb_recv.  */
 char *gdb_recv(struct gdb_conn *conn, /* out */ size_t *size, bool want_stop);
 
 bool gdb_start_noack(struct gdb_conn *conn);
 
+bool gdb_has_noack(struct gdb_conn *conn);
+
+void gdb_set_packet_size(struct gdb_conn *conn, size_t size);
+
+size_t gdb_packet_size(struct gdb_conn *conn);
+
 void gdb_set_non_stop(struct gdb_conn *conn, bool val);
 
 bool gdb_has_non_stop(struct gdb_conn *conn);
 
+bool gdb_clear_notified(struct gdb_conn *conn);
+
 char* pop_notification(size_t *size);
 
-void push_notification(char *packet, size_t packet_size);
+void push_notification(const char *packet, size_t packet_size);
 
 /* Read complete qXfer data, returned as binary with the size.
  * On error, returns NULL with size set to the error code.  */
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Overhead governor (-g PERCENT).  With ptrace, a tracee waits while
+ * strace handles its stop, so the time strace spends outside wait4
+ * is what the tracees lose.  Once a second, that time is compared
+ * with the rest; when it is more than PERCENT of it, the output gets
+ * one step cheaper, and when it falls under half of that, one step
+ * of detail comes back.  Each switch is logged in the trace.
+ */
+
+#include "defs.h"
+
+unsigned int governor_level;
+/* Whether -c counts have been taken, for the summary */
+bool governor_counted;
+
+static unsigned int budget;
+static unsigned int saved_show_fd_path;
+static cflag_t saved_cflag;
+static struct timespec interval_start, wait_start, waited;
+
+static const struct {
+	const char *on;
+	const char *off;
+} modes[] = {
+	[GOVERNOR_ABBREV] = { "abbreviating structures",
+			      "printing structures in full" },
+	[GOVERNOR_NO_PATHS] = { "not printing fd paths",
+				"printing fd paths" },
+	[GOVERNOR_NO_STACKS] = { "not printing stack traces",
+				 "printing stack traces" },
+	[GOVERNOR_COUNT_ONLY] = { "counting syscalls only",
+				  "printing syscalls" },
+};
+
+static const struct timespec interval = { 1, 0 };
+
+int
+governor_option(const char *arg)
+{
+	int percent = string_to_uint(arg);
+
+	if (percent <= 0)
+		return -1;
+	budget = percent;
+
+	return 0;
+}
+
+bool
+governor_enabled(void)
+{
+	return budget != 0;
+}
+
+void
+governor_init(void)
+{
+	saved_show_fd_path = show_fd_path;
+	saved_cflag = cflag;
+	clock_gettime(CLOCK_MONOTONIC, &interval_start);
+}
+
+void
+governor_wait_begin(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &wait_start);
+}
+
+void
+governor_wait_end(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&now, &now, &wait_start);
+	ts_add(&waited, &waited, &now);
+}
+
+/* Whether LEVEL would change anything.  */
+static bool
+level_applies(unsigned int level)
+{
+	switch (level) {
+	case GOVERNOR_NO_PATHS:
+		return saved_show_fd_path != 0;
+	case GOVERNOR_NO_STACKS:
+#ifdef USE_LIBUNWIND
+		return stack_trace_enabled;
+#else
+		return false;
+#endif
+	default:
+		return true;
+	}
+}
+
+static void
+set_level(unsigned int level)
+{
+	governor_level = level;
+	show_fd_path = level >= GOVERNOR_NO_PATHS ? 0 : saved_show_fd_path;
+	if (level >= GOVERNOR_COUNT_ONLY) {
+		cflag = CFLAG_ONLY_STATS;
+		governor_counted = true;
+	} else {
+		cflag = saved_cflag;
+	}
+}
+
+/*
+ * Called for each stop, of TCP, after the wait.  At the end of an
+ * interval, switch mode if need be, and say so in the trace of TCP.
+ */
+void
+governor_check(struct tcb *tcp)
+{
+	struct timespec now, elapsed, busy;
+	unsigned int level = governor_level;
+	unsigned int percent;
+	double run, ratio;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&elapsed, &now, &interval_start);
+	if (ts_cmp(&elapsed, &interval) < 0)
+		return;
+
+	/* The tracees ran while strace waited.  */
+	ts_sub(&busy, &elapsed, &waited);
+	run = waited.tv_sec + waited.tv_nsec / 1e9;
+	ratio = run > 0 ? (busy.tv_sec + busy.tv_nsec / 1e9) / run : 10;
+	percent = 100 * (ratio < 10 ? ratio : 10) + 0.5;
+	interval_start = now;
+	waited.tv_sec = waited.tv_nsec = 0;
+
+	if (percent > budget) {
+		while (level < GOVERNOR_COUNT_ONLY &&
+		       !level_applies(++level))
+			;
+	} else if (2 * percent < budget) {
+		while (level > GOVERNOR_FULL &&
+		       !level_applies(--level))
+			;
+	}
+	if (level == governor_level)
+		return;
+
+	printleader(tcp);
+	tprintf("--- strace overhead %u%% %s %u%%, %s ---\n",
+		percent, level > governor_level ? ">" : "<", budget,
+		level > governor_level ? modes[level].on
+				       : modes[governor_level].off);
+	line_ended();
+	set_level(level);
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compressed output (-L): every log file, including each -ff file,
+ * is written as a gzip stream.
+ *
+ * As with the flight recorder, the compressor sits behind a stdio
+ * stream made with fopencookie, so nothing else in strace needs to know.
+ * The stream is completed when the file is closed and, for files
+ * still open then, at exit.  In between, it is flushed to a byte
+ * boundary at most once a second, so a file cut short by SIGKILL
+ * can still be read up to that point.
+ */
+
+#include "defs.h"
+
+#if defined HAVE_FOPENCOOKIE && defined HAVE_ZLIB
+
+#include <zlib.h>
+
+#define GZLOG_CHUNK 65536
+
+struct gzlog {
+	struct gzlog *next;
+	FILE *fp;	/* The stream strace prints to */
+	FILE *dest;	/* Where the compressed data goes */
+	z_stream zs;
+	struct timespec synced;	/* When the last full flush was done */
+	unsigned char out[GZLOG_CHUNK];
+};
+
+int gzlog_level;
+
+static struct gzlog *streams;
+
+/* Run the compressor with FLUSH, writing whatever it produces to dest.  */
+static int
+gzlog_deflate(struct gzlog *gz, int flush)
+{
+	int rc;
+
+	do {
+		gz->zs.next_out = gz->out;
+		gz->zs.avail_out = sizeof(gz->out);
+		rc = deflate(&gz->zs, flush);
+		if (rc == Z_STREAM_ERROR)
+			return -1;
+		if (fwrite(gz->out, 1, sizeof(gz->out) - gz->zs.avail_out,
+			   gz->dest) != sizeof(gz->out) - gz->zs.avail_out)
+			return -1;
+	} while (gz->zs.avail_out == 0);
+
+	return 0;
+}
+
+static ssize_t
+gzlog_write(void *cookie, const char *data, size_t len)
+{
+	struct gzlog *gz = cookie;
+	struct timespec now;
+	int flush = Z_NO_FLUSH;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec != gz->synced.tv_sec) {
+		gz->synced = now;
+		flush = Z_SYNC_FLUSH;
+	}
+
+	gz->zs.next_in = (unsigned char *) data;
+	gz->zs.avail_in = len;
+	if (gzlog_deflate(gz, flush) < 0)
+		return -1;
+	if (flush != Z_NO_FLUSH)
+		fflush(gz->dest);
+
+	return len;
+}
+
+static int
+gzlog_close(void *cookie)
+{
+	struct gzlog *gz = cookie;
+	struct gzlog **p;
+	int rc;
+
+	for (p = &streams; *p; p = &(*p)->next) {
+		if (*p == gz) {
+			*p = gz->next;
+			break;
+		}
+	}
+	gz->zs.avail_in = 0;
+	rc = gzlog_deflate(gz, Z_FINISH);
+	deflateEnd(&gz->zs);
+	if (fclose(gz->dest))
+		rc = -1;
+	free(gz);
+
+	return rc;
+}
+
+/* Complete the streams nobody has closed, e.g. when strace dies.  */
+static void
+gzlog_close_all(void)
+{
+	while (streams)
+		fclose(streams->fp);
+}
+
+/* Return a stream that compresses into DEST.  */
+FILE *
+gzlog_fopen(FILE *dest)
+{
+	static const cookie_io_functions_t funcs = {
+		.write = gzlog_write,
+		.close = gzlog_close,
+	};
+	static bool registered;
+	struct gzlog *gz = xcalloc(1, sizeof(*gz));
+
+	if (!registered) {
+		atexit(gzlog_close_all);
+		registered = true;
+	}
+
+	/* 15 + 16: the largest window, with a gzip header and trailer.  */
+	if (deflateInit2(&gz->zs, gzlog_level, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		error_msg_and_die("deflateInit2 failed");
+	gz->dest = dest;
+	gz->fp = fopencookie(gz, "w", funcs);
+	if (!gz->fp)
+		perror_msg_and_die("fopencookie");
+	gz->next = streams;
+	streams = gz;
+
+	return gz->fp;
+}
+
+int
+gzlog_option(const char *arg)
+{
+	int level = string_to_uint(arg);
+
+	if (level < 1 || level > 9)
+		return -1;
+	gzlog_level = level;
+
+	return 0;
+}
+
+#else /* !(HAVE_FOPENCOOKIE && HAVE_ZLIB) */
+
+int gzlog_level;
+
+FILE *
+gzlog_fopen(FILE *dest)
+{
+	return dest;
+}
+
+int
+gzlog_option(const char *arg)
+{
+	error_msg_and_die("-L is not supported by this build of strace");
+}
+
+#endif /* HAVE_FOPENCOOKIE && HAVE_ZLIB */
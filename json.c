@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * JSON output (-J).  Every line is rendered to memory as usual and
+ * converted to a JSON object when it ends.  A syscall line becomes
+ *
+ *   {"pid":PID,"tid":TID,"timestamp":SECONDS,"syscall":"NAME",
+ *    "args":[ARG,...],"retval":NUMBER,"errno":"NAME","duration":SECONDS}
+ *
+ * where each ARG is the text printed by the decoder for the argument,
+ * as a JSON number if it is a decimal integer, as a JSON string
+ * otherwise.  The timestamp is the entry time.  Unknown values are null.
+ * Any other line, such as a signal or an exit, becomes
+ *
+ *   {"pid":PID,"tid":TID,"timestamp":SECONDS,"event":"TEXT"}
+ */
+
+#include "defs.h"
+#include "gdbserver.h"
+
+/* The thread group id of TCP, from /proc where it is available.  */
+static int
+get_tgid(struct tcb *tcp)
+{
+	char path[sizeof("/proc/%u/status") + sizeof(int) * 3];
+	char line[64];
+	FILE *fp;
+
+	if (tcp->tgid)
+		return tcp->tgid;
+
+	tcp->tgid = tcp->pid;
+	if (gdbserver)
+		return tcp->tgid;
+
+	sprintf(path, "/proc/%u/status", tcp->pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return tcp->tgid;
+	while (fgets(line, sizeof(line), fp)) {
+		int tgid;
+
+		if (sscanf(line, "Tgid: %d", &tgid) == 1) {
+			if (tgid > 0)
+				tcp->tgid = tgid;
+			break;
+		}
+	}
+	fclose(fp);
+	return tcp->tgid;
+}
+
+/*
+ * The length of the UTF-8 sequence at STR, of at most LEN bytes,
+ * or 0 if it is not a valid one.
+ */
+static size_t
+utf8_len(const unsigned char *str, size_t len)
+{
+	const unsigned char c = str[0];
+	unsigned char min = 0x80, max = 0xbf;
+	size_t n, i;
+
+	if (c < 0xc2 || c > 0xf4)
+		return 0;
+	n = c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+	if (len < n)
+		return 0;
+	/* No overlong forms, surrogates, or code points over 0x10ffff */
+	if (c == 0xe0)
+		min = 0xa0;
+	else if (c == 0xed)
+		max = 0x9f;
+	else if (c == 0xf0)
+		min = 0x90;
+	else if (c == 0xf4)
+		max = 0x8f;
+	if (str[1] < min || str[1] > max)
+		return 0;
+	for (i = 2; i < n; ++i) {
+		if (str[i] < 0x80 || str[i] > 0xbf)
+			return 0;
+	}
+	return n;
+}
+
+/*
+ * Print STR of length LEN as a JSON string.  Valid UTF-8 is kept as
+ * it is; other bytes above 0x7f, which a JSON string cannot carry,
+ * are written as the text \xNN, so that they can still be told apart.
+ */
+static void
+json_string(const char *str, size_t len)
+{
+	const char *run = str;
+
+	tprints("\"");
+	while (len) {
+		const unsigned char c = *str;
+		char buf[sizeof("\\u00ff")];
+		size_t n;
+
+		if (c >= ' ' && c < 0x7f && c != '"' && c != '\\') {
+			++str;
+			--len;
+			continue;
+		}
+		if (c >= 0x80) {
+			n = utf8_len((const unsigned char *) str, len);
+			if (n) {
+				str += n;
+				len -= n;
+				continue;
+			}
+		}
+		tprintn(run, str - run);
+		if (c == '"' || c == '\\') {
+			buf[0] = '\\';
+			buf[1] = c;
+			tprintn(buf, 2);
+		} else if (c >= 0x80) {
+			sprintf(buf, "\\\\x%02x", c);
+			tprintn(buf, 5);
+		} else {
+			sprintf(buf, "\\u%04x", c);
+			tprintn(buf, 6);
+		}
+		run = ++str;
+		--len;
+	}
+	tprintn(run, str - run);
+	tprints("\"");
+}
+
+static bool
+is_json_number(const char *str, size_t len)
+{
+	if (len && *str == '-') {
+		++str;
+		--len;
+	}
+	if (!len || (*str == '0' && len > 1))
+		return false;
+	for (; len; ++str, --len) {
+		if (*str < '0' || *str > '9')
+			return false;
+	}
+	return true;
+}
+
+static void
+json_value(const char *str, size_t len)
+{
+	while (len && *str == ' ') {
+		++str;
+		--len;
+	}
+	while (len && str[len - 1] == ' ')
+		--len;
+
+	if (is_json_number(str, len))
+		tprintn(str, len);
+	else
+		json_string(str, len);
+}
+
+/*
+ * Print the arguments in STR, which starts right after the opening
+ * parenthesis of a syscall line, as the elements of a JSON array.
+ * Arguments are separated by the commas outside of quotes and brackets,
+ * the top level closing parenthesis ends them.
+ */
+static void
+json_args(const char *str, const char *end)
+{
+	const char *arg = str;
+	const char *p;
+	unsigned int depth = 0;
+	bool quoted = false;
+
+	for (p = str; p < end; ++p) {
+		if (quoted) {
+			if (*p == '\\' && p + 1 < end)
+				++p;
+			else if (*p == '"')
+				quoted = false;
+			continue;
+		}
+		switch (*p) {
+		case '"':
+			quoted = true;
+			break;
+		case '(':
+		case '[':
+		case '{':
+			++depth;
+			break;
+		case ')':
+			if (!depth)
+				goto done;
+			/* fall through */
+		case ']':
+		case '}':
+			if (depth)
+				--depth;
+			break;
+		case ',':
+			if (!depth) {
+				json_value(arg, p - arg);
+				tprints(",");
+				arg = p + 1;
+			}
+			break;
+		}
+	}
+done:
+	if (p > arg || arg > str)
+		json_value(arg, p - arg);
+}
+
+static void
+json_print_header(struct tcb *tcp, const struct timespec *ts)
+{
+	struct timespec rt = *ts;
+
+	clock_to_realtime(&rt);
+	tprints("{\"pid\":");
+	tprint_dec(get_tgid(tcp));
+	tprints(",\"tid\":");
+	tprint_dec(tcp->pid);
+	tprints(",\"timestamp\":");
+	tprint_timespec(&rt, 0);
+}
+
+static void
+json_print_result(struct tcb *tcp, int sys_res)
+{
+	if (sys_res >= 0 && (tcp->qual_flg & QUAL_RAW))
+		sys_res = RVAL_HEX;
+	else if (sys_res & RVAL_NONE)
+		sys_res = -1;
+
+	if (sys_res < 0) {
+		tprints(",\"retval\":null,\"errno\":null");
+	} else if (tcp->u_error) {
+		const char *name = err_name(tcp->u_error);
+
+		tprints(is_erestart(tcp) ? ",\"retval\":null" : ",\"retval\":-1");
+		tprints(",\"errno\":");
+		if (name)
+			json_string(name, strlen(name));
+		else
+			tprint_udec(tcp->u_error);
+	} else {
+		tprints(",\"retval\":");
+		switch (sys_res & RVAL_MASK) {
+		case RVAL_DECIMAL:
+		case RVAL_FD:
+			tprint_dec(tcp->u_rval);
+			break;
+#if HAVE_STRUCT_TCB_EXT_ARG
+		case RVAL_LUDECIMAL:
+			tprint_udec(tcp->u_lrval);
+			break;
+#endif
+		default:
+#if SUPPORTED_PERSONALITIES > 1
+			if (current_wordsize < sizeof(long))
+				tprint_udec((unsigned int) tcp->u_rval);
+			else
+#endif
+				tprint_udec((unsigned long) tcp->u_rval);
+			break;
+		}
+		tprints(",\"errno\":null");
+	}
+}
+
+/*
+ * Print the syscall line TEXT of TCP as JSON.  The syscall returned at
+ * TS with SYS_RES from its decoder; TS is NULL and SYS_RES is -1 if
+ * the result is unknown.
+ */
+void
+json_print_syscall(struct tcb *tcp, const char *text, size_t len,
+		   const struct timespec *ts, int sys_res)
+{
+	const char *end = text + len;
+	const char *args = memchr(text, '(', len);
+	struct timespec now;
+
+	if (!args)
+		args = end;
+
+	if (ts) {
+		json_print_header(tcp, &tcp->etime);
+	} else {
+		clock_now(&now);
+		json_print_header(tcp, &now);
+	}
+	tprints(",\"syscall\":");
+	json_string(text, args - text);
+	tprints(",\"args\":[");
+	if (args < end)
+		json_args(args + 1, end);
+	tprints("]");
+	json_print_result(tcp, ts ? sys_res : -1);
+	tprints(",\"duration\":");
+	if (ts) {
+		struct timespec dts;
+
+		ts_sub(&dts, ts, &tcp->etime);
+		tprint_timespec(&dts, 0);
+	} else {
+		tprints("null");
+	}
+	tprints("}\n");
+}
+
+/* Print the line TEXT about TCP, which is not a syscall, as JSON.  */
+void
+json_print_event(struct tcb *tcp, const char *text, size_t len)
+{
+	struct timespec now;
+
+	while (len && text[len - 1] == '\n')
+		--len;
+
+	clock_now(&now);
+	json_print_header(tcp, &now);
+	tprints(",\"event\":");
+	json_string(text, len);
+	tprints("}\n");
+}
@@ -0,0 +1,654 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Tracing without stopping tracees (-X perf).
+ *
+ * Every traced thread gets a raw_syscalls:sys_enter and a sys_exit
+ * sampling event on each CPU; with -f the events are inherited by the
+ * children.  All events of a CPU write to one ring buffer, which
+ * strace maps and reads.  The samples of all rings are merged by time
+ * and each one is handed to trace_syscall() with the number, arguments
+ * or return value it carries, so the usual decoders do the printing.
+ *
+ * Tracees run on while strace lags behind, so whatever a decoder reads
+ * from their memory is read after the fact and may have changed since
+ * the syscall.  When the kernel finds a ring full, it drops samples and
+ * says how many; strace reports that.
+ */
+
+#include "defs.h"
+
+#if defined HAVE_LINUX_PERF_EVENT_H && defined __NR_perf_event_open
+
+#include <elf.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+#include "syscall.h"
+
+#ifndef __X32_SYSCALL_BIT
+# define __X32_SYSCALL_BIT	0x40000000
+#endif
+
+/* Pages of samples in each per-cpu ring; a power of 2.  */
+#define PERF_RING_PAGES 128
+/* How late a sample may show up in its ring after its timestamp.  */
+#define PERF_REORDER_NS 10000000
+
+/* A record taken from a ring, waiting to be decoded in time order.  */
+struct perf_rec {
+	uint64_t time;
+	unsigned long seq;	/* To keep the order of equal times */
+	enum {
+		PERF_REC_ENTER,
+		PERF_REC_EXIT,
+		PERF_REC_FORK,
+		PERF_REC_GONE,
+	} kind;
+	int tid;
+	int ptid;		/* PERF_REC_FORK: the parent */
+	long nr;
+	long args[6];		/* PERF_REC_EXIT: the return value */
+};
+
+/*
+ * The events of a traced thread.  With -f, its children inherit them,
+ * and closing them would stop the sampling of the children too, so
+ * they are shared with the children's tcbs and closed with the last one.
+ */
+struct perf_events {
+	unsigned int refs;
+	unsigned int nfds;
+	int fds[];
+};
+
+struct perf_ring {
+	int fd;		/* The event the ring is mapped from, or -1 */
+	struct perf_event_mmap_page *page;
+	char *data;
+};
+
+static struct perf_ring *rings;
+static unsigned int nrings;
+static size_t page_size;
+
+static int enter_id, exit_id;
+static int id_off, args_off, ret_off;
+static unsigned int word_size;	/* Of the kernel, for the fields above */
+
+static struct perf_rec *queue;
+static size_t queue_len, queue_size;
+static unsigned long seq;
+/* Samples dropped by the kernel, not reported yet.  */
+static unsigned long long lost;
+static time_t lost_reported;
+/* What to add to sample times, which are monotonic, to get clock_id.  */
+static int64_t clock_delta;
+
+static int
+open_event(unsigned int type, int config, int tid, int cpu, bool task)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = type;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.sample_period = 1;
+	attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+	attr.inherit = type == PERF_TYPE_TRACEPOINT && followfork;
+	attr.task = task;
+	attr.sample_id_all = 1;
+	attr.watermark = 1;
+	attr.wakeup_watermark = PERF_RING_PAGES * page_size / 4;
+	attr.use_clockid = 1;
+	attr.clockid = CLOCK_MONOTONIC;
+
+	fd = syscall(__NR_perf_event_open, &attr, tid, cpu, -1, 0);
+	if (fd >= 0)
+		set_cloexec_flag(fd);
+	return fd;
+}
+
+/*
+ * Map the ring of CPU.  It belongs to a dummy event of strace itself,
+ * so that it outlives the tracees whose samples go there.
+ */
+static int
+map_ring(unsigned int cpu)
+{
+	struct perf_ring *r = &rings[cpu];
+	int fd = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_DUMMY,
+			    0, cpu, false);
+	void *p;
+
+	if (fd < 0)
+		return -1;
+	p = mmap(NULL, (PERF_RING_PAGES + 1) * page_size,
+		 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	r->fd = fd;
+	r->page = p;
+	r->data = (char *) p + page_size;
+	return 0;
+}
+
+#if SUPPORTED_PERSONALITIES > 1
+/* The personality of the program TID runs, judging by its ELF header.  */
+static unsigned int
+exe_personality(int tid)
+{
+	char path[sizeof("/proc/%d/exe") + sizeof(int) * 3];
+	unsigned char hdr[EI_NIDENT + 4];
+	unsigned int pers = 0;
+	int fd;
+
+	sprintf(path, "/proc/%d/exe", tid);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return current_personality;
+	if (read(fd, hdr, sizeof(hdr)) == sizeof(hdr) &&
+	    hdr[EI_CLASS] == ELFCLASS32 && sizeof(long) == 8)
+		pers = 1;
+# ifdef X86_64
+	/* x32 is told by the syscall numbers instead.  */
+	if (pers && (hdr[EI_NIDENT + 2] | hdr[EI_NIDENT + 3] << 8) == EM_X86_64)
+		pers = 0;
+# endif
+	close(fd);
+	return pers;
+}
+#endif
+
+/* Read a kernel long at P.  */
+static long
+get_word(const char *p)
+{
+	if (word_size == 4) {
+		int32_t v;
+
+		memcpy(&v, p, sizeof(v));
+		return v;
+	} else {
+		int64_t v;
+
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+}
+
+static struct perf_rec *
+queue_add(uint64_t time, int kind, int tid)
+{
+	struct perf_rec *rec;
+
+	if (queue_len == queue_size) {
+		queue_size = queue_size ? queue_size * 2 : 1024;
+		queue = xreallocarray(queue, queue_size, sizeof(*queue));
+	}
+	rec = &queue[queue_len++];
+	rec->time = time;
+	rec->seq = seq++;
+	rec->kind = kind;
+	rec->tid = tid;
+	return rec;
+}
+
+/* Queue the record at P, of the format perf_event_header describes.  */
+static void
+parse_record(const char *p)
+{
+	const struct perf_event_header *h = (const void *) p;
+	const char *body = p + sizeof(*h);
+	struct perf_rec *rec;
+	uint32_t ids[4];
+	uint64_t time;
+
+	switch (h->type) {
+	case PERF_RECORD_SAMPLE: {
+		/* pid, tid, time, and the raw tracepoint record */
+		uint32_t raw_size;
+		const char *raw = body + 20;
+		uint16_t type;
+		unsigned int i;
+
+		memcpy(ids, body, 8);
+		memcpy(&time, body + 8, 8);
+		memcpy(&raw_size, body + 16, 4);
+		if (raw_size < 2)
+			return;
+		memcpy(&type, raw, sizeof(type));
+		if (type == enter_id && raw_size >= args_off + 6 * word_size) {
+			rec = queue_add(time, PERF_REC_ENTER, ids[1]);
+			rec->nr = get_word(raw + id_off);
+			for (i = 0; i < 6; ++i)
+				rec->args[i] = get_word(raw + args_off + i * word_size);
+		} else if (type == exit_id && raw_size >= ret_off + word_size) {
+			rec = queue_add(time, PERF_REC_EXIT, ids[1]);
+			rec->nr = get_word(raw + id_off);
+			rec->args[0] = get_word(raw + ret_off);
+		}
+		break;
+	}
+	case PERF_RECORD_FORK:
+	case PERF_RECORD_EXIT:
+		/* pid, ppid, tid, ptid, time */
+		memcpy(ids, body, sizeof(ids));
+		memcpy(&time, body + sizeof(ids), 8);
+		rec = queue_add(time, h->type == PERF_RECORD_FORK
+				      ? PERF_REC_FORK : PERF_REC_GONE, ids[2]);
+		rec->ptid = ids[3];
+		break;
+	case PERF_RECORD_LOST: {
+		/* id, lost */
+		uint64_t n;
+
+		memcpy(&n, body + 8, sizeof(n));
+		lost += n;
+		break;
+	}
+	}
+}
+
+/* Queue everything in the ring R.  */
+static void
+read_ring(struct perf_ring *r)
+{
+	static char buf[65536];
+	const size_t size = PERF_RING_PAGES * page_size;
+	uint64_t head = r->page->data_head;
+	uint64_t tail = r->page->data_tail;
+
+	/* Read data_head before the data it covers.  */
+	__sync_synchronize();
+
+	while (tail < head) {
+		size_t off = tail % size;
+		struct perf_event_header h;
+		const char *p;
+
+		memcpy(&h, r->data + off, sizeof(h));
+		if (h.size < sizeof(h))
+			break;
+		if (off + h.size <= size) {
+			p = r->data + off;
+		} else {
+			memcpy(buf, r->data + off, size - off);
+			memcpy(buf + size - off, r->data, h.size - (size - off));
+			p = buf;
+		}
+		parse_record(p);
+		tail += h.size;
+	}
+
+	/* Finish with the data before giving it back.  */
+	__sync_synchronize();
+	r->page->data_tail = head;
+}
+
+static int
+rec_cmp(const void *a, const void *b)
+{
+	const struct perf_rec *x = a, *y = b;
+
+	if (x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void
+decode_enter(struct tcb *tcp, const struct perf_rec *rec)
+{
+	unsigned long nr = rec->nr;
+	unsigned int i;
+
+	if (rec->nr == -1)
+		return;
+	if (tcp->flags & TCB_STARTUP) {
+		tcp->flags &= ~TCB_STARTUP;
+#if SUPPORTED_PERSONALITIES > 1
+		tcp->currpers = exe_personality(tcp->pid);
+#endif
+	}
+
+#if SUPPORTED_PERSONALITIES > 1
+	unsigned int pers = tcp->currpers;
+# if defined X86_64
+	if (nr & __X32_SYSCALL_BIT) {
+		nr -= __X32_SYSCALL_BIT;
+		pers = 2;
+	} else if (pers == 2) {
+		pers = 0;
+	}
+# endif
+	update_personality(tcp, pers);
+#endif
+
+	/*
+	 * Samples can be lost: whatever was in progress,
+	 * this is a new syscall.
+	 */
+	tcp->flags &= ~TCB_INSYSCALL;
+	tcp->scno = nr;
+	for (i = 0; i < ARRAY_SIZE(rec->args); ++i)
+		tcp->u_arg[i] = rec->args[i];
+	trace_syscall(tcp);
+}
+
+static void
+decode_exit(struct tcb *tcp, const struct perf_rec *rec)
+{
+	if (!exiting(tcp))
+		return;
+	tcp->u_rval = rec->args[0];
+	trace_syscall(tcp);
+#if SUPPORTED_PERSONALITIES > 1
+	if (tcp->s_ent && tcp->s_ent->sen == SEN_execve && rec->args[0] == 0)
+		tcp->currpers = exe_personality(tcp->pid);
+#endif
+}
+
+static void
+decode_fork(const struct perf_rec *rec)
+{
+	struct tcb *parent = pid2tcb(rec->ptid);
+	struct tcb *tcp;
+
+	if (!followfork || !parent || pid2tcb(rec->tid))
+		return;
+	tcp = alloctcb(rec->tid);
+	tcp->flags |= TCB_ATTACHED;
+	tcp->perf_events = parent->perf_events;
+	if (tcp->perf_events)
+		++tcp->perf_events->refs;
+#if SUPPORTED_PERSONALITIES > 1
+	tcp->currpers = parent->currpers;
+#endif
+	newoutf(tcp);
+}
+
+static void
+decode(const struct perf_rec *rec)
+{
+	struct tcb *tcp;
+	struct timespec ts;
+
+	if (rec->kind == PERF_REC_FORK) {
+		decode_fork(rec);
+		return;
+	}
+
+	tcp = pid2tcb(rec->tid);
+	if (!tcp)
+		return;
+	current_tcp = tcp;
+	ts.tv_sec = (rec->time + clock_delta) / 1000000000;
+	ts.tv_nsec = (rec->time + clock_delta) % 1000000000;
+	event_time = &ts;
+
+	switch (rec->kind) {
+	case PERF_REC_ENTER:
+		decode_enter(tcp, rec);
+		break;
+	case PERF_REC_EXIT:
+		decode_exit(tcp, rec);
+		break;
+	case PERF_REC_GONE:
+		backend_gone(tcp);
+		break;
+	default:
+		break;
+	}
+
+	event_time = NULL;
+}
+
+/*
+ * Set up the rings.
+ * Return 0 on success, -1 if perf events cannot be used.
+ */
+int
+perftrace_init(void)
+{
+	const char *event = "raw_syscalls/sys_enter";
+	unsigned int cpu;
+	int fd, exit_id_off;
+
+	page_size = get_pagesize();
+	enter_id = tracefs_event_id("raw_syscalls/sys_enter");
+	exit_id = tracefs_event_id("raw_syscalls/sys_exit");
+	id_off = tracefs_field_offset(event, "id");
+	args_off = tracefs_field_offset(event, "args[6]");
+	event = "raw_syscalls/sys_exit";
+	exit_id_off = tracefs_field_offset(event, "id");
+	ret_off = tracefs_field_offset(event, "ret");
+	if (enter_id < 0 || exit_id < 0) {
+		error_msg("cannot find raw_syscalls in tracefs");
+		return -1;
+	}
+	word_size = args_off - id_off;
+	if (id_off < 0 || exit_id_off != id_off ||
+	    (word_size != 4 && word_size != 8) ||
+	    ret_off != id_off + (int) word_size) {
+		error_msg("cannot parse the format of raw_syscalls");
+		return -1;
+	}
+
+	if (clock_id != CLOCK_MONOTONIC) {
+		struct timespec mt, ct;
+
+		clock_gettime(CLOCK_MONOTONIC, &mt);
+		clock_gettime(clock_id, &ct);
+		clock_delta = (ct.tv_sec - mt.tv_sec) * 1000000000LL +
+			      ct.tv_nsec - mt.tv_nsec;
+	}
+
+	/* See whether strace may sample itself.  */
+	fd = open_event(PERF_TYPE_TRACEPOINT, enter_id, 0, -1, false);
+	if (fd < 0) {
+		perror_msg("perf_event_open");
+		return -1;
+	}
+	close(fd);
+
+	nrings = cpu_list_max("/sys/devices/system/cpu/possible") + 1;
+	if (!nrings)
+		nrings = 1;
+	rings = xcalloc(nrings, sizeof(*rings));
+	for (cpu = 0; cpu < nrings; ++cpu) {
+		rings[cpu].fd = -1;
+		if (map_ring(cpu) < 0 && errno != ENODEV) {
+			perror_msg("perf_event_open(cpu %u)", cpu);
+			return -1;
+		}
+	}
+
+	if (!qflag)
+		error_msg("-X perf: tracees are not stopped, arguments"
+			  " in their memory are read late and may have"
+			  " changed since the syscall");
+	return 0;
+}
+
+/*
+ * Open an event of CONFIG for thread TID on CPU into EV,
+ * writing to the ring of CPU.
+ */
+static int
+add_event(struct perf_events *ev, int config, int tid, unsigned int cpu,
+	  bool task)
+{
+	int fd = open_event(PERF_TYPE_TRACEPOINT, config, tid, cpu, task);
+
+	if (fd < 0)
+		return -1;
+	ev->fds[ev->nfds++] = fd;
+	return ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, rings[cpu].fd);
+}
+
+static void
+close_events(struct perf_events *ev)
+{
+	int saved_errno = errno;
+	unsigned int i;
+
+	for (i = 0; i < ev->nfds; ++i)
+		close(ev->fds[i]);
+	free(ev);
+	errno = saved_errno;
+}
+
+/*
+ * Sample the syscalls of TCP.
+ * Return 0 on success, -1 with errno set on failure.
+ */
+int
+perftrace_add(struct tcb *tcp)
+{
+	struct perf_events *ev;
+	unsigned int cpu;
+
+	ev = xcalloc(1, sizeof(*ev) + 2 * nrings * sizeof(ev->fds[0]));
+	for (cpu = 0; cpu < nrings; ++cpu) {
+		if (rings[cpu].fd < 0)
+			continue;	/* offline */
+		/* The sys_enter event also reports forks and exits.  */
+		if (add_event(ev, enter_id, tcp->pid, cpu, true) < 0 ||
+		    add_event(ev, exit_id, tcp->pid, cpu, false) < 0) {
+			close_events(ev);
+			return -1;
+		}
+	}
+	ev->refs = 1;
+	tcp->perf_events = ev;
+	return 0;
+}
+
+/*
+ * TCP is going away: close its events, unless children that inherited
+ * them are still traced.
+ */
+void
+perftrace_drop(struct tcb *tcp)
+{
+	struct perf_events *ev = tcp->perf_events;
+
+	tcp->perf_events = NULL;
+	if (ev && --ev->refs == 0)
+		close_events(ev);
+}
+
+/* Wait up to TIMEOUT milliseconds for the rings to fill up.  */
+void
+perftrace_wait(int timeout)
+{
+	struct pollfd *fds = xcalloc(nrings, sizeof(*fds));
+	unsigned int i, n = 0;
+
+	for (i = 0; i < nrings; ++i) {
+		if (rings[i].fd < 0)
+			continue;
+		fds[n].fd = rings[i].fd;
+		fds[n].events = POLLIN;
+		++n;
+	}
+	poll(fds, n, timeout);
+	free(fds);
+}
+
+/*
+ * Decode the samples in the rings, in time order.  Unless ALL,
+ * leave the most recent ones for the next call: the rings
+ * of other CPUs may still get samples that go before them.
+ */
+void
+perftrace_decode(bool all)
+{
+	struct timespec now;
+	uint64_t limit;
+	size_t i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	limit = now.tv_sec * 1000000000ULL + now.tv_nsec - PERF_REORDER_NS;
+
+	for (i = 0; i < nrings; ++i) {
+		if (rings[i].fd >= 0)
+			read_ring(&rings[i]);
+	}
+	/* Once a second at most, and at the end.  */
+	if (lost && (all || now.tv_sec != lost_reported)) {
+		error_msg("-X perf: %llu events lost", lost);
+		lost = 0;
+		lost_reported = now.tv_sec;
+	}
+
+	qsort(queue, queue_len, sizeof(*queue), rec_cmp);
+	for (n = 0; n < queue_len && (all || queue[n].time < limit); ++n)
+		decode(&queue[n]);
+	queue_len -= n;
+	memmove(queue, queue + n, queue_len * sizeof(*queue));
+}
+
+#else /* !(HAVE_LINUX_PERF_EVENT_H && __NR_perf_event_open) */
+
+int
+perftrace_init(void)
+{
+	error_msg("-X perf is not supported by this build of strace");
+	return -1;
+}
+
+int
+perftrace_add(struct tcb *tcp)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void
+perftrace_drop(struct tcb *tcp)
+{
+}
+
+void
+perftrace_wait(int timeout)
+{
+}
+
+void
+perftrace_decode(bool all)
+{
+}
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Tracing as a seccomp supervisor (-X seccomp).
+ *
+ * Just before execve, the child installs a seccomp filter that sends
+ * the traced syscalls to a user notification listener, and leaves the
+ * descriptor number in memory shared with strace, which takes the
+ * listener over with pidfd_getfd.  The execve waits for strace, so
+ * nothing is missed.  Every notification carries the thread, the
+ * syscall number and the arguments; they are handed to trace_syscall(),
+ * the decoders read the memory of the thread, which waits for the
+ * answer, and the syscall is let through with
+ * SECCOMP_USER_NOTIF_FLAG_CONTINUE.
+ *
+ * Syscalls that are not traced never leave the kernel, and there is
+ * no exit stop: return values are never seen.  The filter is inherited
+ * by all descendants of the child and cannot be removed, and once the
+ * listener is closed their notified syscalls fail with ENOSYS, so
+ * strace keeps answering until all of them have gone.
+ */
+
+#include "defs.h"
+
+#ifdef HAVE_LINUX_SECCOMP_H
+# include <linux/seccomp.h>
+#endif
+
+#if defined SECCOMP_FILTER_FLAG_NEW_LISTENER \
+ && defined SECCOMP_USER_NOTIF_FLAG_CONTINUE && defined __NR_seccomp \
+ && defined __NR_pidfd_open && defined __NR_pidfd_getfd
+
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include "syscall.h"
+
+#ifndef __X32_SYSCALL_BIT
+# define __X32_SYSCALL_BIT	0x40000000
+#endif
+
+#define SECCOMP_MAX_INSNS	4096
+
+/*
+ * The audit architectures of the personalities.  The filter picks the
+ * traced syscalls of each; syscalls of any other architecture are all
+ * sent to strace, which decodes them in the first personality.
+ */
+static const struct {
+	uint32_t arch;
+	uint32_t nr_bit;
+	unsigned int pers;
+} arches[] = {
+#if defined X86_64
+	{ AUDIT_ARCH_X86_64, 0, 0 },
+	{ AUDIT_ARCH_I386, 0, 1 },
+	{ AUDIT_ARCH_X86_64, __X32_SYSCALL_BIT, 2 },
+#elif defined X32
+	{ AUDIT_ARCH_X86_64, __X32_SYSCALL_BIT, 0 },
+	{ AUDIT_ARCH_I386, 0, 1 },
+#elif defined I386
+	{ AUDIT_ARCH_I386, 0, 0 },
+#elif defined AARCH64
+	{ AUDIT_ARCH_AARCH64, 0, 0 },
+	{ AUDIT_ARCH_ARM, 0, 1 },
+#elif defined ARM
+	{ AUDIT_ARCH_ARM, 0, 0 },
+#else
+	{ 0, 0, 0 },
+#endif
+};
+
+static struct sock_filter *prog;
+static unsigned short prog_len;
+
+/* Where the child leaves the listener descriptor, plus one.  */
+static volatile int *shared_fd;
+
+static int listener = -1;
+static bool listener_hup;
+
+static void
+emit(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf)
+{
+	struct sock_filter insn = { code, jt, jf, k };
+
+	if (prog_len >= SECCOMP_MAX_INSNS)
+		error_msg_and_die("-X seccomp: too many syscalls to filter");
+	prog[prog_len++] = insn;
+}
+
+/* Send syscall NR to strace.  */
+static void
+emit_notify_if(uint32_t nr)
+{
+	emit(BPF_JMP | BPF_JEQ | BPF_K, nr, 0, 1);
+	emit(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF, 0, 0);
+}
+
+/*
+ * Emit the part of the filter for arches[i]: the traced syscalls,
+ * execve to hand strace the listener and follow personality changes,
+ * and exit to know the exit status.
+ */
+static void
+emit_arch(unsigned int i)
+{
+	const unsigned int pers = arches[i].pers;
+	const unsigned int old_pers = current_personality;
+	unsigned short skip;
+	unsigned int *scnos, count = 0, scno, j;
+
+	emit(BPF_LD | BPF_W | BPF_ABS,
+	     offsetof(struct seccomp_data, arch), 0, 0);
+	emit(BPF_JMP | BPF_JEQ | BPF_K, arches[i].arch, 1, 0);
+	skip = prog_len;
+	emit(BPF_JMP | BPF_JA, 0, 0, 0);
+
+	emit(BPF_LD | BPF_W | BPF_ABS,
+	     offsetof(struct seccomp_data, nr), 0, 0);
+#if defined X86_64 || defined X32
+	/* x86_64 and x32 share the architecture.  */
+	emit(BPF_JMP | BPF_JSET | BPF_K, __X32_SYSCALL_BIT,
+	     arches[i].nr_bit ? 1 : 0, arches[i].nr_bit ? 0 : 1);
+	emit(BPF_JMP | BPF_JA, 0, 0, 0);
+	const unsigned short skip_bit = prog_len - 1;
+#endif
+
+	scnos = traced_scnos(pers, &count);
+	if (!scnos) {
+		emit(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF, 0, 0);
+	} else {
+		for (j = 0; j < count; ++j)
+			emit_notify_if(scnos[j] | arches[i].nr_bit);
+		set_personality(pers);
+		for (scno = 0; scno < nsyscalls; ++scno) {
+			switch (sysent[scno].sen) {
+			case SEN_execve:
+			case SEN_execveat:
+			case SEN_exit:
+				emit_notify_if(scno | arches[i].nr_bit);
+				break;
+			}
+		}
+		set_personality(old_pers);
+		emit(BPF_RET | BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+		free(scnos);
+	}
+
+	prog[skip].k = prog_len - skip - 1;
+#if defined X86_64 || defined X32
+	prog[skip_bit].k = prog_len - skip_bit - 1;
+#endif
+}
+
+/*
+ * Build the filter.
+ * Return 0 on success, -1 if seccomp user notifications cannot be used.
+ */
+int
+seccomptrace_init(void)
+{
+	struct seccomp_notif_sizes sizes;
+	unsigned int i;
+
+	if (NOMMU_SYSTEM) {
+		error_msg("-X seccomp: not supported on NOMMU systems");
+		return -1;
+	}
+	if (syscall(__NR_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) < 0) {
+		perror_msg("seccomp(SECCOMP_GET_NOTIF_SIZES)");
+		return -1;
+	}
+
+	prog = xcalloc(SECCOMP_MAX_INSNS, sizeof(*prog));
+	if (arches[0].arch) {
+		for (i = 0; i < ARRAY_SIZE(arches); ++i)
+			emit_arch(i);
+	}
+	emit(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF, 0, 0);
+
+	shared_fd = mmap(NULL, sizeof(*shared_fd), PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared_fd == MAP_FAILED) {
+		perror_msg("mmap");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Install the filter in the child, just before execve.
+ * Without CAP_SYS_ADMIN, this needs no_new_privs.
+ */
+void
+seccomptrace_install(void)
+{
+	struct sock_fprog fprog = { prog_len, prog };
+	int fd;
+
+	fd = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+		     SECCOMP_FILTER_FLAG_NEW_LISTENER, &fprog);
+	if (fd < 0 && errno == EACCES &&
+	    prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0)
+		fd = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+			     SECCOMP_FILTER_FLAG_NEW_LISTENER, &fprog);
+	if (fd < 0)
+		perror_msg_and_die("seccomp(SECCOMP_SET_MODE_FILTER)");
+	*shared_fd = fd + 1;
+}
+
+/*
+ * Take over the listener of child PID.
+ * Return 0 on success, -1 with errno set on failure.
+ */
+int
+seccomptrace_attach(int pid)
+{
+	static const struct timespec interval = { 0, 1000000 };
+	siginfo_t si;
+	int pidfd;
+
+	while (!*shared_fd) {
+		si.si_pid = 0;
+		if (waitid(P_PID, pid, &si,
+			   WEXITED | WNOHANG | WNOWAIT) < 0)
+			return -1;
+		if (si.si_pid) {
+			errno = ESRCH;
+			return -1;
+		}
+		nanosleep(&interval, NULL);
+	}
+
+	pidfd = syscall(__NR_pidfd_open, pid, 0);
+	if (pidfd < 0)
+		return -1;
+	/* The new descriptor is close-on-exec.  */
+	listener = syscall(__NR_pidfd_getfd, pidfd, *shared_fd - 1, 0);
+	close(pidfd);
+
+	return listener < 0 ? -1 : 0;
+}
+
+/*
+ * Wait up to TIMEOUT milliseconds for a notification.
+ * Return true if there is one.
+ */
+bool
+seccomptrace_wait(int timeout)
+{
+	struct pollfd pfd = { listener, POLLIN, 0 };
+
+	if (poll(&pfd, 1, timeout) <= 0)
+		return false;
+	if (pfd.revents & POLLHUP)
+		listener_hup = true;
+	return pfd.revents & POLLIN;
+}
+
+/* Return false once nobody uses the filter any longer.  */
+bool
+seccomptrace_alive(void)
+{
+	return !listener_hup;
+}
+
+static struct tcb *
+notif_tcb(const struct seccomp_notif *notif)
+{
+	struct tcb *tcp = pid2tcb(notif->pid);
+
+	if (tcp || !followfork)
+		return tcp;
+	tcp = alloctcb(notif->pid);
+	tcp->flags |= TCB_ATTACHED;
+	newoutf(tcp);
+	return tcp;
+}
+
+static void
+decode(struct tcb *tcp, const struct seccomp_notif *notif)
+{
+	unsigned long nr = notif->data.nr;
+	unsigned int i;
+
+	tcp->flags &= ~TCB_STARTUP;
+
+#if SUPPORTED_PERSONALITIES > 1
+	unsigned int pers = 0;
+
+	for (i = 0; i < ARRAY_SIZE(arches); ++i) {
+		if (arches[i].arch == notif->data.arch &&
+		    (nr & __X32_SYSCALL_BIT) == arches[i].nr_bit) {
+			pers = arches[i].pers;
+			nr &= ~arches[i].nr_bit;
+			break;
+		}
+	}
+	update_personality(tcp, pers);
+#endif
+
+	current_tcp = tcp;
+	tcp->flags &= ~TCB_INSYSCALL;
+	tcp->scno = nr;
+	for (i = 0; i < ARRAY_SIZE(notif->data.args); ++i)
+		tcp->u_arg[i] = notif->data.args[i];
+	trace_syscall(tcp);
+
+	/*
+	 * There is no exit stop, so end the line at once.  Exits
+	 * do not return; the status is printed when the thread is gone.
+	 */
+	if (exiting(tcp) && tcp->s_ent->sen != SEN_exit)
+		trace_syscall(tcp);
+}
+
+/* Decode the pending notifications and let their syscalls go on.  */
+void
+seccomptrace_decode(void)
+{
+	struct pollfd pfd = { listener, POLLIN, 0 };
+
+	do {
+		struct seccomp_notif notif;
+		struct seccomp_notif_resp resp;
+		struct tcb *tcp;
+
+		memset(&notif, 0, sizeof(notif));
+		if (ioctl(listener, SECCOMP_IOCTL_NOTIF_RECV, &notif) < 0) {
+			/* The thread has gone meanwhile.  */
+			if (errno == ENOENT || errno == EINTR)
+				continue;
+			perror_msg_and_die("ioctl(SECCOMP_IOCTL_NOTIF_RECV)");
+		}
+
+		tcp = notif_tcb(&notif);
+		if (tcp)
+			decode(tcp, &notif);
+
+		memset(&resp, 0, sizeof(resp));
+		resp.id = notif.id;
+		resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &resp) < 0 &&
+		    errno != ENOENT)
+			perror_msg_and_die("ioctl(SECCOMP_IOCTL_NOTIF_SEND)");
+	} while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN));
+}
+
+#else /* !(SECCOMP_FILTER_FLAG_NEW_LISTENER && ... && __NR_pidfd_getfd) */
+
+int
+seccomptrace_init(void)
+{
+	error_msg("-X seccomp is not supported by this build of strace");
+	return -1;
+}
+
+void
+seccomptrace_install(void)
+{
+}
+
+int
+seccomptrace_attach(int pid)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+bool
+seccomptrace_wait(int timeout)
+{
+	return false;
+}
+
+bool
+seccomptrace_alive(void)
+{
+	return false;
+}
+
+void
+seccomptrace_decode(void)
+{
+}
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Snapshot of a thread on attach (-H): what /proc/TID/syscall says it
+ * is blocked in, shown as the entry of that syscall, followed by its
+ * wait channel and kernel stack.
+ *
+ * The files are read before the thread is attached, as attaching
+ * interrupts the syscall; the arguments are decoded afterwards,
+ * by the usual decoders, while the thread stays put.
+ */
+
+#include "defs.h"
+
+struct snapshot {
+	bool running;		/* Not blocked, nothing to show */
+	long nr;		/* Syscall number, or -1 if not in a syscall */
+	unsigned long args[6];
+	unsigned long sp;
+	unsigned long pc;
+	char wchan[64];
+	char *stack;		/* Contents of /proc/TID/stack, if readable */
+};
+
+static FILE *
+proc_fopen(int tid, const char *name)
+{
+	char path[sizeof("/proc/%d/stack") + sizeof(int) * 3];
+
+	sprintf(path, "/proc/%d/%s", tid, name);
+	return fopen(path, "r");
+}
+
+/* Read the state of thread TID, or return NULL if it is gone.  */
+struct snapshot *
+snapshot_read(int tid)
+{
+	struct snapshot *s;
+	char buf[512];
+	size_t size = 0;
+	FILE *fp;
+
+	fp = proc_fopen(tid, "syscall");
+	if (!fp)
+		return NULL;
+	s = xcalloc(1, sizeof(*s));
+	if (!fgets(buf, sizeof(buf), fp)) {
+		fclose(fp);
+		free(s);
+		return NULL;
+	}
+	fclose(fp);
+
+	if (strncmp(buf, "running", 7) == 0) {
+		s->running = true;
+		return s;
+	}
+	if (sscanf(buf, "%ld %lx %lx %lx %lx %lx %lx %lx %lx", &s->nr,
+		   &s->args[0], &s->args[1], &s->args[2], &s->args[3],
+		   &s->args[4], &s->args[5], &s->sp, &s->pc) != 9) {
+		s->nr = -1;
+		sscanf(buf, "%*d %lx %lx", &s->sp, &s->pc);
+	}
+
+	fp = proc_fopen(tid, "wchan");
+	if (fp) {
+		if (!fgets(s->wchan, sizeof(s->wchan), fp))
+			s->wchan[0] = '\0';
+		fclose(fp);
+	}
+
+	/* Readable by root only.  */
+	fp = proc_fopen(tid, "stack");
+	if (fp) {
+		FILE *mem = open_memstream(&s->stack, &size);
+
+		if (mem) {
+			size_t n;
+
+			while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+				fwrite(buf, 1, n, mem);
+			fclose(mem);
+		}
+		fclose(fp);
+	}
+
+	return s;
+}
+
+void
+snapshot_free(struct snapshot *s)
+{
+	if (s) {
+		free(s->stack);
+		free(s);
+	}
+}
+
+/* Show snapshot S of TCP, which it frees.  */
+void
+snapshot_print(struct tcb *tcp, struct snapshot *s)
+{
+	const char *line, *end;
+
+	if (s->running) {
+		printleader(tcp);
+		tprints("+++ running +++\n");
+		line_ended();
+		snapshot_free(s);
+		return;
+	}
+
+	if (s->nr >= 0) {
+		unsigned int saved_show_fd_path = show_fd_path;
+		unsigned int i;
+
+		if (!show_fd_path)
+			show_fd_path = 1;
+		current_tcp = tcp;
+		tcp->flags &= ~TCB_INSYSCALL;
+		tcp->scno = s->nr;
+		for (i = 0; i < ARRAY_SIZE(s->args); ++i)
+			tcp->u_arg[i] = s->args[i];
+		snapshot_syscall_entering(tcp);
+		if (tcp->flags & TCB_DEFERRED)
+			commit_deferred_line(tcp);
+		if (!filtered(tcp)) {
+			tprints(" <in progress>\n");
+			line_ended();
+		}
+		tcp->flags &= ~(TCB_INSYSCALL | TCB_FILTERED);
+		tcp->sys_func_rval = 0;
+		free_tcb_priv_data(tcp);
+		show_fd_path = saved_show_fd_path;
+	}
+
+	printleader(tcp);
+	tprintf("+++ waiting in %s, sp %#lx, pc %#lx +++\n",
+		s->wchan[0] && strcmp(s->wchan, "0") ? s->wchan : "?",
+		s->sp, s->pc);
+	line_ended();
+
+	/* Lines like "[<0>] do_nanosleep+0x8b/0x150".  */
+	for (line = s->stack; line && *line; line = end + 1) {
+		const char *sym = strstr(line, "] ");
+
+		end = strchr(line, '\n');
+		if (!end)
+			break;
+		if (!sym || sym > end)
+			continue;
+		sym += 2;
+		tprintf(" > %.*s\n", (int) (end - sym), sym);
+		line_ended();
+	}
+
+	snapshot_free(s);
+}
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * strace-query: group-by and top-N queries over the columnar trace
+ * files written by strace -W, see coltrace.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "coltrace.h"
+
+static const char *const errnoent[] = {
+#include "errnoent.h"
+};
+
+struct group {
+	uint64_t key;
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t total;		/* Duration in ns */
+	uint64_t max;
+	bool used;
+};
+
+static struct group *groups;
+static size_t groups_size;
+static size_t ngroups;
+
+/* The strings of the file, numbered from 1 */
+static const char **strs;
+static size_t *str_lens;
+static bool *str_selected;	/* Whether it is a syscall given with -e */
+static size_t nstrs;
+static size_t strs_size;
+
+static char **selected;
+static unsigned int nselected;
+
+static const char *progname = "strace-query";
+static const char *fname;
+
+static void __attribute__((noreturn, format(printf, 1, 2)))
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s: ", progname);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr)
+		die("out of memory");
+	return ptr;
+}
+
+static void __attribute__((noreturn))
+usage(int status)
+{
+	printf("\
+usage: %s [-g key] [-s order] [-n count] [-e syscall[,syscall]...] file\n\
+\n\
+Summarise syscalls recorded with strace -W, one line per group.\n\
+\n\
+  -e syscall,... only count these syscalls\n\
+  -g key         group by: syscall (default), path, fd, tid, errno\n\
+  -n count       print only the first COUNT groups (default 20, 0 for all)\n\
+  -s order       sort by: total (default), calls, errors, max\n\
+\n\
+Example: the paths with the highest total open latency\n\
+  %s -e open,openat -g path trace.col\n\
+", progname, progname);
+	exit(status);
+}
+
+static struct group *
+find_group(uint64_t key)
+{
+	size_t i;
+
+	if (ngroups * 2 >= groups_size) {
+		struct group *old = groups;
+		size_t old_size = groups_size;
+
+		groups_size = groups_size ? groups_size * 2 : 1024;
+		groups = xrealloc(NULL, groups_size * sizeof(*groups));
+		memset(groups, 0, groups_size * sizeof(*groups));
+		ngroups = 0;
+		for (i = 0; i < old_size; ++i) {
+			if (old[i].used)
+				*find_group(old[i].key) = old[i];
+		}
+		free(old);
+	}
+
+	for (i = (key * 0x9e3779b97f4a7c15ULL) >> 32 & (groups_size - 1);
+	     groups[i].used; i = (i + 1) & (groups_size - 1)) {
+		if (groups[i].key == key)
+			return &groups[i];
+	}
+	groups[i].used = true;
+	groups[i].key = key;
+	++ngroups;
+	return &groups[i];
+}
+
+static void
+add_string(const unsigned char *str, size_t len)
+{
+	unsigned int i;
+
+	if (nstrs + 1 >= strs_size) {
+		strs_size = strs_size ? strs_size * 2 : 1024;
+		strs = xrealloc(strs, strs_size * sizeof(*strs));
+		str_lens = xrealloc(str_lens, strs_size * sizeof(*str_lens));
+		str_selected = xrealloc(str_selected,
+					strs_size * sizeof(*str_selected));
+	}
+	++nstrs;
+	strs[nstrs] = (const char *) str;
+	str_lens[nstrs] = len;
+	str_selected[nstrs] = false;
+	for (i = 0; i < nselected; ++i) {
+		if (strlen(selected[i]) == len && !memcmp(selected[i], str, len))
+			str_selected[nstrs] = true;
+	}
+}
+
+static void
+bad_file(void)
+{
+	die("%s: not a valid columnar trace file", fname);
+}
+
+static void
+read_file(enum coltrace_column key_col)
+{
+	const unsigned char *p, *end;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		die("%s: %m", fname);
+	if ((size_t) st.st_size < COLTRACE_MAGIC_SIZE)
+		bad_file();
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		die("%s: %m", fname);
+	close(fd);
+
+	p = map;
+	end = p + st.st_size;
+	if (memcmp(p, COLTRACE_MAGIC, COLTRACE_MAGIC_SIZE))
+		bad_file();
+	p += COLTRACE_MAGIC_SIZE;
+
+	while (p < end) {
+		const unsigned char *col[COLTRACE_NCOLS];
+		const unsigned char *col_end[COLTRACE_NCOLS];
+		uint64_t nrec, n, len;
+		unsigned int i;
+
+		if (!coltrace_get(&p, end, &nrec) || !coltrace_get(&p, end, &n))
+			bad_file();
+		for (; n; --n) {
+			if (!coltrace_get(&p, end, &len) ||
+			    len > (uint64_t) (end - p))
+				bad_file();
+			add_string(p, len);
+			p += len;
+		}
+		for (i = 0; i < COLTRACE_NCOLS; ++i) {
+			if (!coltrace_get(&p, end, &len) ||
+			    len > (uint64_t) (end - p))
+				bad_file();
+			col[i] = p;
+			col_end[i] = p += len;
+		}
+
+		for (; nrec; --nrec) {
+			uint64_t v[COLTRACE_NCOLS];
+			struct group *g;
+
+			for (i = 0; i < COLTRACE_NCOLS; ++i) {
+				if (!coltrace_get(&col[i], col_end[i], &v[i]))
+					bad_file();
+			}
+			/* Every record has a syscall name; 0 is no string.  */
+			if (!v[COLTRACE_SYSCALL] ||
+			    v[COLTRACE_SYSCALL] > nstrs || v[COLTRACE_PATH] > nstrs)
+				bad_file();
+			if (nselected && !str_selected[v[COLTRACE_SYSCALL]])
+				continue;
+			if (!v[key_col] &&
+			    (key_col == COLTRACE_PATH || key_col == COLTRACE_FD))
+				continue;
+
+			g = find_group(v[key_col]);
+			g->calls++;
+			g->errors += v[COLTRACE_ERRNO] != 0;
+			g->total += v[COLTRACE_DURATION];
+			if (g->max < v[COLTRACE_DURATION])
+				g->max = v[COLTRACE_DURATION];
+		}
+	}
+}
+
+static int
+sort_by_total(const void *a, const void *b)
+{
+	const struct group *ga = a, *gb = b;
+
+	return ga->total < gb->total ? 1 : ga->total > gb->total ? -1 : 0;
+}
+
+static int
+sort_by_calls(const void *a, const void *b)
+{
+	const struct group *ga = a, *gb = b;
+
+	return ga->calls < gb->calls ? 1 : ga->calls > gb->calls ? -1 : 0;
+}
+
+static int
+sort_by_errors(const void *a, const void *b)
+{
+	const struct group *ga = a, *gb = b;
+
+	return ga->errors < gb->errors ? 1 : ga->errors > gb->errors ? -1 : 0;
+}
+
+static int
+sort_by_max(const void *a, const void *b)
+{
+	const struct group *ga = a, *gb = b;
+
+	return ga->max < gb->max ? 1 : ga->max > gb->max ? -1 : 0;
+}
+
+static void
+print_key(enum coltrace_column key_col, uint64_t key)
+{
+	switch (key_col) {
+	case COLTRACE_SYSCALL:
+	case COLTRACE_PATH:
+		printf("%.*s", (int) str_lens[key], strs[key]);
+		break;
+	case COLTRACE_FD:
+		printf("%llu", (unsigned long long) key - 1);
+		break;
+	case COLTRACE_ERRNO:
+		if (!key)
+			printf("(success)");
+		else if (key < sizeof(errnoent) / sizeof(errnoent[0]) &&
+			 errnoent[key])
+			printf("%s", errnoent[key]);
+		else
+			printf("%llu", (unsigned long long) key);
+		break;
+	default:
+		printf("%llu", (unsigned long long) key);
+		break;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		enum coltrace_column col;
+	} keys[] = {
+		{ "syscall", COLTRACE_SYSCALL },
+		{ "path", COLTRACE_PATH },
+		{ "fd", COLTRACE_FD },
+		{ "tid", COLTRACE_TID },
+		{ "errno", COLTRACE_ERRNO },
+	};
+	static const struct {
+		const char *name;
+		int (*cmp)(const void *, const void *);
+	} orders[] = {
+		{ "total", sort_by_total },
+		{ "calls", sort_by_calls },
+		{ "errors", sort_by_errors },
+		{ "max", sort_by_max },
+	};
+	enum coltrace_column key_col = COLTRACE_SYSCALL;
+	int (*cmp)(const void *, const void *) = sort_by_total;
+	unsigned long count = 20;
+	struct group *sorted;
+	size_t i, n;
+	int c;
+
+	if (argv[0] && strrchr(argv[0], '/'))
+		progname = strrchr(argv[0], '/') + 1;
+	else if (argv[0])
+		progname = argv[0];
+
+	while ((c = getopt(argc, argv, "e:g:hn:s:")) != -1) {
+		char *end, *tok;
+
+		switch (c) {
+		case 'e':
+			for (tok = strtok(optarg, ","); tok;
+			     tok = strtok(NULL, ",")) {
+				selected = xrealloc(selected, (nselected + 1) *
+						    sizeof(*selected));
+				selected[nselected++] = tok;
+			}
+			break;
+		case 'g':
+			for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+				if (!strcmp(optarg, keys[i].name))
+					break;
+			}
+			if (i == sizeof(keys) / sizeof(keys[0]))
+				die("invalid key '%s'", optarg);
+			key_col = keys[i].col;
+			break;
+		case 'h':
+			usage(0);
+		case 'n':
+			count = strtoul(optarg, &end, 10);
+			if (!*optarg || *end)
+				die("invalid count '%s'", optarg);
+			break;
+		case 's':
+			for (i = 0; i < sizeof(orders) / sizeof(orders[0]); ++i) {
+				if (!strcmp(optarg, orders[i].name))
+					break;
+			}
+			if (i == sizeof(orders) / sizeof(orders[0]))
+				die("invalid order '%s'", optarg);
+			cmp = orders[i].cmp;
+			break;
+		default:
+			usage(1);
+		}
+	}
+	if (optind != argc - 1)
+		usage(1);
+	fname = argv[optind];
+	read_file(key_col);
+
+	sorted = xrealloc(NULL, (ngroups + 1) * sizeof(*sorted));
+	for (i = n = 0; i < groups_size; ++i) {
+		if (groups[i].used)
+			sorted[n++] = groups[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), cmp);
+	if (count && n > count)
+		n = count;
+
+	printf("%10s %8s %14s %12s  %s\n",
+	       "calls", "errors", "total(s)", "max(s)",
+	       key_col == COLTRACE_SYSCALL ? "syscall" :
+	       key_col == COLTRACE_PATH ? "path" :
+	       key_col == COLTRACE_FD ? "fd" :
+	       key_col == COLTRACE_TID ? "tid" : "errno");
+	for (i = 0; i < n; ++i) {
+		printf("%10llu %8llu %14.6f %12.6f  ",
+		       (unsigned long long) sorted[i].calls,
+		       (unsigned long long) sorted[i].errors,
+		       sorted[i].total / 1e9, sorted[i].max / 1e9);
+		print_key(key_col, sorted[i].key);
+		putchar('\n');
+	}
+
+	return 0;
+}
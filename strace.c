@@ -48,6 +48,7 @@
 #include "printsiginfo.h"
 
 #include "gdbserver.h"
+#include "syscall.h"
 
 /* In some libc, these aren't declared. Do it ourself: */
 extern char **environ;
@@ -81,6 +82,7 @@ bool stack_trace_enabled = false;
 const unsigned int syscall_trap_sig = SIGTRAP | 0x80;
 
 cflag_t cflag = CFLAG_NONE;
+backend_t backend = BACKEND_PTRACE;
 unsigned int followfork = 0;
 unsigned int ptrace_setoptions = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC;
 unsigned int xflag = 0;
@@ -91,7 +93,28 @@ bool count_wallclock = 0;
 unsigned int qflag = 0;
 static unsigned int tflag = 0;
 static bool rflag = 0;
+/* -K: clock for timestamps and syscall times, print them in nsecs */
+clockid_t clock_id = CLOCK_REALTIME;
+static bool clock_nsec;
+/* CLOCK_REALTIME - clock_id, to print -t/-tt with a non-realtime clock */
+static struct timespec clock_offset;
 static bool print_pid_pfx = 0;
+/* -j: number of tracer processes the tracees are split among */
+static unsigned int ntracers = 1;
+/* -H: show what the tracees are blocked in; -HH: and detach at once */
+static unsigned int snapshot_flag;
+/* -A window,period: trace for WINDOW out of every PERIOD */
+static struct timespec duty_window, duty_period;
+static int *duty_pids;		/* The -p pids, 0 once gone */
+static unsigned int duty_npids;
+static struct timespec duty_start;	/* When the first window began */
+static struct timespec duty_begin;	/* When the current window began */
+static struct timespec duty_end;	/* When it ends */
+static struct timespec duty_traced;	/* Total length of the windows */
+/* Whether ptrace stops are waited for with sigwaitinfo */
+static bool sigwait_stops;
+/* Whether wait4 may have stops to report that no SIGCHLD is pending for */
+static bool stops_pending = true;
 
 /* -I n */
 enum {
@@ -130,11 +153,17 @@ static int post_attach_sigstop = TCB_IGNORE_ONE_SIGSTOP;
 
 /* Sometimes we want to print only succeeding syscalls. */
 bool not_failing_only = 0;
+/* Or only failing ones. */
+bool failing_only = 0;
+/* Print runs of identical syscall lines only once */
+bool collapse_repeats;
+/* Print lines as JSON objects, see json.c */
+bool json_output;
 
 /* Show path associated with fd arguments */
 unsigned int show_fd_path = 0;
 
-static bool detach_on_execve = 0;
+bool detach_on_execve = 0;
 /* Are we "strace PROG" and need to skip detach on first execve? */
 static bool skip_one_b_execve = 0;
 /* Are we "strace PROG" and need to hide everything until execve? */
@@ -156,6 +185,27 @@ static char *outfname = NULL;
 /* If -ff, points to stderr. Else, it's our common output log */
 static FILE *shared_log;
 
+/* -R: dump requested with SIGUSR1, or by a trigger */
+static volatile sig_atomic_t flightrec_requested;
+static bool flightrec_pending;
+static FILE *flightrec_pending_fp;
+
+/* -J: lines other than syscalls are rendered here */
+static FILE *json_event_fp;
+static char *json_event_buf;
+static size_t json_event_size;
+
+/* Whether syscall entry and exit times have to be measured */
+bool measure_syscall_time;
+/* Whether syscall lines are filtered on exit, see start_deferred_line */
+bool defer_lines;
+
+/* -B: size of output buffers, 0 means flush every line */
+unsigned int outbuf_size;
+/* -B: flush buffered output at least this often, in milliseconds */
+static unsigned int outbuf_interval;
+static struct timespec outbuf_flushed;
+
 struct tcb *printing_tcp = NULL;
 struct tcb *current_tcp;
 
@@ -201,22 +251,37 @@ static void
 usage(void)
 {
 	printf("\
-usage: strace [-CdffhiqrtttTvVwxxy] [-I n] [-e expr]...\n\
-              [-a column] [-o file] [-s strsize] [-P path]...\n\
+usage: strace [-CdffhHiJqrtttTUvVwxxyzZ] [-I n] [-j n] [-e expr]...\n\
+              [-a column] [-o file] [-s strsize] [-P path]... [-g percent]\n\
+              [-B size[,msec]] [-K clock] [-R size[,trigger]...]\n\
+              [-L level] [-W file] [-X backend] [-A window,period]\n\
               -p pid... / [-D] [-E var=val]... [-u username] PROG [ARGS]\n\
    or: strace -c[dfw] [-I n] [-e expr]... [-O overhead] [-S sortby]\n\
+              [-X backend] [-A window,period]\n\
               -p pid... / [-D] [-E var=val]... [-u username] PROG [ARGS]\n\
 \n\
 Output format:\n\
   -a column      alignment COLUMN for printing syscall results (default %d)\n\
+  -B size[,msec] buffer SIZE bytes of output, flush at least every MSEC ms\n\
   -i             print instruction pointer at time of syscall\n\
+  -J             print each syscall and event as a JSON object\n\
   -o file        send trace output to FILE instead of stderr\n\
+  -L level       gzip-compress the -o files at LEVEL (1-9)\n\
+  -R size[,trigger]...\n\
+                 keep the last SIZE bytes of output in memory, write them\n\
+                 on SIGUSR1 or a trigger: signal, latency=DURATION,\n\
+                 SYSCALL=ERRNO\n\
   -q             suppress messages about attaching, detaching, etc.\n\
   -r             print relative timestamp\n\
   -s strsize     limit length of print strings to STRSIZE chars (default %d)\n\
   -t             print absolute timestamp\n\
   -tt            print absolute timestamp with usecs\n\
   -T             print time spent in each syscall\n\
+  -W file        also record syscalls in columnar FILE, see strace-query\n\
+  -g percent     print less detail while tracing slows tracees by more\n\
+                 than PERCENT: abbreviate, drop -y and -k, then only count\n\
+  -U             print repeated syscalls once, followed by a repeat count\n\
+  -K clock       use CLOCK (realtime, monotonic) for the above, print nsecs\n\
   -x             print non-ascii strings in hex\n\
   -xx            print all strings in hex\n\
   -y             print paths associated with file descriptor arguments\n\
@@ -228,17 +293,33 @@ Statistics:\n\
   -O overhead    set overhead for tracing syscalls to OVERHEAD usecs\n\
   -S sortby      sort syscall counts by: time, calls, name, nothing (default %s)\n\
   -w             summarise syscall latency (default is system time)\n\
+  -X backend     get syscalls from BACKEND: ptrace (default), bpf to\n\
+                 count them in the kernel (-c only), perf to read them\n\
+                 from perf ring buffers; neither bpf nor perf stops tracees;\n\
+                 or seccomp to stop tracees only on entry to traced syscalls\n\
 \n\
 Filtering:\n\
   -e expr        a qualifying expression: option=[!]all or option=[!]val1[,val2]...\n\
      options:    trace, abbrev, verbose, raw, signal, read, write\n\
+  -e latency>=duration\n\
+                 show only syscalls that take at least DURATION (e.g. 5ms)\n\
+  -e status=[!]errno,...\n\
+                 show only syscalls that fail [not] with one of these errors\n\
   -P path        trace accesses to path\n\
+  -z             show only successful syscalls\n\
+  -Z             show only failed syscalls\n\
 \n\
 Tracing:\n\
+  -A window,period\n\
+                 trace the -p pids only for WINDOW out of every PERIOD,\n\
+                 scale -c counts up to the whole time\n\
   -b execve      detach on execve syscall\n\
   -D             run tracer process as a detached grandchild, not as parent\n\
   -f             follow forks\n\
   -ff            follow forks with output into separate files\n\
+  -H             on attach with -p, show what the tracees are blocked in\n\
+  -HH            ... and detach right away\n\
+  -j n           split the tracees of -p among N tracer processes\n\
   -I interruptible\n\
      1:          no signals are blocked\n\
      2:          fatal signals are blocked while decoding syscall (default)\n\
@@ -265,9 +346,6 @@ Miscellaneous:\n\
 /* ancient, no one should use it
 -F -- attempt to follow vforks (deprecated, use -f)\n\
  */
-/* this is broken, so don't document it
--z -- print only succeeding syscalls\n\
- */
 , DEFAULT_ACOLUMN, DEFAULT_STRLEN, DEFAULT_SORTBY);
 	exit(0);
 }
@@ -429,7 +507,7 @@ ptrace_restart(int op, struct tcb *tcp, int sig)
 	return -1;
 }
 
-static void
+void
 set_cloexec_flag(int fd)
 {
 	int flags, newflags;
@@ -577,17 +655,17 @@ tprintf(const char *fmt, ...)
 	va_end(args);
 }
 
-#ifndef HAVE_FPUTS_UNLOCKED
-# define fputs_unlocked fputs
+#ifndef HAVE_FWRITE_UNLOCKED
+# define fwrite_unlocked fwrite
 #endif
 
+/* Print LEN bytes of STR, which need not be NUL-terminated.  */
 void
-tprints(const char *str)
+tprintn(const char *str, size_t len)
 {
 	if (current_tcp) {
-		int n = fputs_unlocked(str, current_tcp->outf);
-		if (n >= 0) {
-			current_tcp->curcol += strlen(str);
+		if (fwrite_unlocked(str, 1, len, current_tcp->outf) == len) {
+			current_tcp->curcol += len;
 			return;
 		}
 		if (current_tcp->outf != stderr)
@@ -595,22 +673,220 @@ tprints(const char *str)
 	}
 }
 
+void
+tprints(const char *str)
+{
+	tprintn(str, strlen(str));
+}
+
+/*
+ * Typed appenders for the most frequently printed numbers.
+ * They produce the same text as the corresponding printf conversions
+ * but format straight into a small buffer on the stack.
+ */
+
+/* Same as "%llu".  */
+void
+tprint_udec(unsigned long long val)
+{
+	char buf[sizeof(val) * 3];
+	char *p = buf + sizeof(buf);
+
+	do {
+		*--p = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	tprintn(p, buf + sizeof(buf) - p);
+}
+
+/* Same as "%lld".  */
+void
+tprint_dec(long long val)
+{
+	char buf[sizeof(val) * 3 + 1];
+	char *p = buf + sizeof(buf);
+	unsigned long long uval = val < 0 ? -(unsigned long long) val
+						 : (unsigned long long) val;
+
+	do {
+		*--p = '0' + uval % 10;
+		uval /= 10;
+	} while (uval);
+	if (val < 0)
+		*--p = '-';
+	tprintn(p, buf + sizeof(buf) - p);
+}
+
+/* Same as "%#llx".  */
+void
+tprint_hex(unsigned long long val)
+{
+	char buf[sizeof(val) * 2 + 2];
+	char *p = buf + sizeof(buf);
+
+	if (!val) {
+		tprintn("0", 1);
+		return;
+	}
+	do {
+		*--p = "0123456789abcdef"[val & 0xf];
+		val >>= 4;
+	} while (val);
+	*--p = 'x';
+	*--p = '0';
+	tprintn(p, buf + sizeof(buf) - p);
+}
+
+/* With -X perf, the time of the event being decoded.  */
+const struct timespec *event_time;
+
+/* Read the clock selected with -K, or the time of the current event.  */
+void
+clock_now(struct timespec *ts)
+{
+	if (event_time)
+		*ts = *event_time;
+	else
+		clock_gettime(clock_id, ts);
+}
+
+/* Convert TS read with clock_now() to the realtime clock.  */
+void
+clock_to_realtime(struct timespec *ts)
+{
+	if (clock_id != CLOCK_REALTIME)
+		ts_add(ts, ts, &clock_offset);
+}
+
+/* Print ".usecs", or ".nsecs" with -K.  */
+static void
+tprint_fraction(unsigned long nsec)
+{
+	char buf[sizeof(".123456789")];
+	char *p = buf + sizeof(buf);
+	unsigned int digits = 9;
+
+	if (!clock_nsec) {
+		nsec /= 1000;
+		digits = 6;
+	}
+	while (digits--) {
+		*--p = '0' + nsec % 10;
+		nsec /= 10;
+	}
+	*--p = '.';
+	tprintn(p, buf + sizeof(buf) - p);
+}
+
+/* Print TS as seconds, right-aligned in WIDTH columns, and a fraction.  */
+void
+tprint_timespec(const struct timespec *ts, int width)
+{
+	unsigned long long sec = ts->tv_sec;
+	int n = 0;
+
+	do
+		n++;
+	while (sec /= 10);
+	for (; n < width; n++)
+		tprints(" ");
+	tprint_dec(ts->tv_sec);
+	tprint_fraction(ts->tv_nsec);
+}
+
+/*
+ * With -B, output is only written out when a buffer fills up, when
+ * a tracee goes away, and when an interval given with -B has passed;
+ * that is checked at the end of each line and, so that output does
+ * not sit in the buffers while tracees are quiet, while waiting
+ * for them.
+ */
+static void
+flush_buffered(FILE *fp)
+{
+	struct timespec now, diff;
+
+	if (!outbuf_interval)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&diff, &now, &outbuf_flushed);
+	if ((unsigned long) diff.tv_sec * 1000 + diff.tv_nsec / 1000000
+	    < outbuf_interval)
+		return;
+	outbuf_flushed = now;
+	if (followfork >= 2) {
+		/* every -ff file has its own buffer */
+		fflush(NULL);
+	} else {
+		fflush(fp);
+	}
+}
+
+/*
+ * Ask for the flight recorder of TCP to be written out
+ * once the current line is complete.
+ */
+void
+flightrec_trigger(struct tcb *tcp)
+{
+	FILE *fp = followfork >= 2 ? tcp->outf : shared_log;
+
+	if (flightrec_pending && flightrec_pending_fp != fp)
+		fp = NULL;
+	flightrec_pending = true;
+	flightrec_pending_fp = fp;
+}
+
+static void
+flightrec_dump_pending(void)
+{
+	if (flightrec_requested) {
+		flightrec_requested = 0;
+		flightrec_dump(NULL);
+	}
+	if (flightrec_pending) {
+		flightrec_pending = false;
+		flightrec_dump(flightrec_pending_fp);
+	}
+}
+
+static void
+flightrec_request(int sig)
+{
+	flightrec_requested = 1;
+}
+
+static void deferred_line_ended(struct tcb *);
+
 void
 line_ended(void)
 {
+	if (current_tcp && current_tcp->defer_outf)
+		deferred_line_ended(current_tcp);
 	if (current_tcp) {
 		current_tcp->curcol = 0;
-		fflush(current_tcp->outf);
+		if (outbuf_size)
+			flush_buffered(current_tcp->outf);
+		else
+			fflush(current_tcp->outf);
 	}
 	if (printing_tcp) {
 		printing_tcp->curcol = 0;
 		printing_tcp = NULL;
 	}
+	if (flightrec_pending || flightrec_requested)
+		flightrec_dump_pending();
 }
 
-void
-printleader(struct tcb *tcp)
+static void end_repeats(struct tcb *);
+
+/* Make TCP the tcb we print for, after ending the previous line.  */
+static void
+switch_printing_tcp(struct tcb *tcp)
 {
+	if (tcp->flags & TCB_REPEAT)
+		end_repeats(tcp);
+
 	/* If -ff, "previous tcb we printed" is always the same as current,
 	 * because we have per-tcb output files.
 	 */
@@ -634,38 +910,302 @@ printleader(struct tcb *tcp)
 	printing_tcp = tcp;
 	current_tcp = tcp;
 	current_tcp->curcol = 0;
+}
+
+/*
+ * Deferred lines.  When whether a syscall is shown depends on how it
+ * returns, its entry part is rendered into a per-tcb memory stream
+ * rather than the log, and only copied to the log if the syscall
+ * passes the filters at exit.  While the syscall is in progress the
+ * tcb keeps printing other events (signals etc.) to its log as usual.
+ */
+
+/* Start rendering the entry of the current syscall of TCP to memory.  */
+void
+start_deferred_line(struct tcb *tcp)
+{
+	if (!tcp->defer_fp) {
+		tcp->defer_fp = open_memstream(&tcp->defer_buf,
+					       &tcp->defer_size);
+		if (!tcp->defer_fp)
+			die_out_of_memory();
+	} else {
+		rewind(tcp->defer_fp);
+	}
+	tcp->defer_outf = tcp->outf;
+	tcp->outf = tcp->defer_fp;
+	tcp->flags |= TCB_DEFERRED;
+}
+
+/* The entry has been rendered, switch TCP back to its log.  */
+void
+suspend_deferred_line(struct tcb *tcp)
+{
+	off_t len;
+
+	fflush(tcp->defer_fp);
+	len = ftello(tcp->defer_fp);
+	tcp->defer_len = len > 0 ? len : 0;
+	tcp->outf = tcp->defer_outf;
+	tcp->defer_outf = NULL;
+	tcp->curcol = 0;
+}
+
+/* Copy the deferred entry of TCP to the log and continue the line.  */
+void
+commit_deferred_line(struct tcb *tcp)
+{
+	tcp->flags &= ~TCB_DEFERRED;
+	switch_printing_tcp(tcp);
+	tprintn(tcp->defer_buf, tcp->defer_len);
+}
+
+void
+drop_deferred_line(struct tcb *tcp)
+{
+	tcp->flags &= ~TCB_DEFERRED;
+}
+
+/*
+ * Repeated syscalls.  With -U, the exit part of a deferred line is
+ * rendered to memory as well, and the complete line is compared with
+ * the last one shown for the same tcb by a hash of its text from the
+ * end of the leader to the -T time.  A line that matches is counted
+ * instead of shown; the count is printed when anything else gets
+ * printed for the tcb.
+ */
+
+/* Continue rendering the line of TCP to memory after its entry.  */
+void
+resume_deferred_line(struct tcb *tcp)
+{
+	tcp->defer_outf = tcp->outf;
+	tcp->outf = tcp->defer_fp;
+	tcp->curcol = tcp->defer_len;
+	current_tcp = tcp;
+}
+
+/* FNV-1a */
+uint64_t
+hash_text(const char *text, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		hash ^= (unsigned char) *text++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/*
+ * The line of TCP has been rendered up to TEXT_END, the syscall
+ * returned at TS with SYS_RES from its decoder; TS is NULL and SYS_RES
+ * is -1 if the result is unknown.  Copy the line to the log, as JSON
+ * with -J, and return true, or count it as a repeat and return false.
+ */
+bool
+finish_deferred_line(struct tcb *tcp, size_t text_end,
+		     const struct timespec *ts, int sys_res)
+{
+	uint64_t hash = 0;
+
+	suspend_deferred_line(tcp);
+	if (collapse_repeats && ts) {
+		hash = hash_text(tcp->defer_buf + tcp->defer_text,
+				 text_end - tcp->defer_text);
+		if ((tcp->flags & TCB_REPEAT) && hash == tcp->repeat_hash) {
+			tcp->repeat_count++;
+			tcp->repeat_last = *ts;
+			drop_deferred_line(tcp);
+			return false;
+		}
+	}
+
+	if (json_output) {
+		tcp->flags &= ~TCB_DEFERRED;
+		switch_printing_tcp(tcp);
+		json_print_syscall(tcp, tcp->defer_buf + tcp->defer_text,
+				   tcp->defer_len - tcp->defer_text,
+				   ts, sys_res);
+	} else {
+		commit_deferred_line(tcp);
+	}
+
+	if (collapse_repeats && ts) {
+		tcp->flags |= TCB_REPEAT;
+		tcp->repeat_hash = hash;
+		tcp->repeat_first = tcp->repeat_last = *ts;
+	}
+	return true;
+}
+
+/*
+ * TCP goes away in the middle of a syscall whose line is deferred:
+ * its result will never be known, so show the line as unfinished,
+ * whatever the filters, as with -J a line with a null result.
+ */
+static void
+end_deferred_line(struct tcb *tcp)
+{
+	if (!(tcp->flags & TCB_DEFERRED))
+		return;
+	if (json_output) {
+		/* drop the separator before the arguments not printed yet */
+		if (tcp->defer_len >= tcp->defer_text + 2
+		    && !memcmp(tcp->defer_buf + tcp->defer_len - 2, ", ", 2))
+			tcp->defer_len -= 2;
+		fseeko(tcp->defer_fp, tcp->defer_len, SEEK_SET);
+		resume_deferred_line(tcp);
+		finish_deferred_line(tcp, tcp->defer_len, NULL, -1);
+		line_ended();
+	} else {
+		/* the next line or droptcb ends it with <unfinished ...> */
+		commit_deferred_line(tcp);
+	}
+}
+
+/* Print the number of repeats of the last line shown for TCP, if any.  */
+static void
+end_repeats(struct tcb *tcp)
+{
+	unsigned int count = tcp->repeat_count;
+	struct timespec dts;
+
+	tcp->flags &= ~TCB_REPEAT;
+	if (!count)
+		return;
+	tcp->repeat_count = 0;
+
+	ts_sub(&dts, &tcp->repeat_last, &tcp->repeat_first);
+	printleader(tcp);
+	tprints("... repeated ");
+	tprint_udec(count);
+	tprints(count == 1 ? " time over " : " times over ");
+	tprint_timespec(&dts, 0);
+	tprints("s\n");
+	line_ended();
+}
+
+/* -J: render a line other than a syscall of TCP to memory.  */
+static void
+start_json_event(struct tcb *tcp)
+{
+	if (!json_event_fp) {
+		json_event_fp = open_memstream(&json_event_buf,
+					       &json_event_size);
+		if (!json_event_fp)
+			die_out_of_memory();
+	} else {
+		rewind(json_event_fp);
+	}
+	tcp->defer_outf = tcp->outf;
+	tcp->outf = json_event_fp;
+	current_tcp = tcp;
+	tcp->curcol = 0;
+}
+
+/*
+ * The line TCP has been rendering to memory has ended: a deferred
+ * syscall line that is complete without a result, such as exit's,
+ * or, with -J, any other line.
+ */
+static void
+deferred_line_ended(struct tcb *tcp)
+{
+	off_t len;
+
+	if (tcp->outf != json_event_fp) {
+		/* exit or exit_group, or the result is unavailable */
+		finish_deferred_line(tcp, tcp->curcol, NULL, -1);
+		return;
+	}
+
+	fflush(json_event_fp);
+	len = ftello(json_event_fp);
+	tcp->outf = tcp->defer_outf;
+	tcp->defer_outf = NULL;
+	tcp->curcol = 0;
+	switch_printing_tcp(tcp);
+	json_print_event(tcp, json_event_buf, len > 0 ? len : 0);
+}
+
+void
+printleader(struct tcb *tcp)
+{
+	if (tcp->defer_outf) {
+		/* Rendering a deferred entry, the log is not touched.  */
+		current_tcp = tcp;
+		tcp->curcol = 0;
+	} else if (json_output) {
+		/* Print the count first, it is rendered to memory as well. */
+		if (tcp->flags & TCB_REPEAT)
+			end_repeats(tcp);
+		start_json_event(tcp);
+	} else {
+		switch_printing_tcp(tcp);
+	}
 
-	if (print_pid_pfx)
-		tprintf("%-5d ", tcp->pid);
-	else if (nprocs > 1 && !outfname)
-		tprintf("[pid %5u] ", tcp->pid);
+	/* With -J, pid and time are fields of the JSON object.  */
+	if (json_output)
+		return;
+
+	if (print_pid_pfx) {
+		/* "%-5d " */
+		tprint_dec(tcp->pid);
+		tprints(&"      "[tcp->curcol < 5 ? tcp->curcol : 5]);
+	} else if ((nprocs > 1 || ntracers > 1) && !outfname) {
+		/* "[pid %5u] " */
+		char buf[sizeof("[pid 4294967295] ")];
+		char *p = buf + sizeof(buf);
+		unsigned int pid = tcp->pid;
+
+		*--p = ' ';
+		*--p = ']';
+		do {
+			*--p = '0' + pid % 10;
+			pid /= 10;
+		} while (pid);
+		while (p > buf + sizeof(buf) - sizeof("12345] ") + 1)
+			*--p = ' ';
+		p -= sizeof("[pid ") - 1;
+		memcpy(p, "[pid ", sizeof("[pid ") - 1);
+		tprintn(p, buf + sizeof(buf) - p);
+	}
 
 	if (tflag) {
-		char str[sizeof("HH:MM:SS")];
-		struct timeval tv, dtv;
-		static struct timeval otv;
+		/* "HH:MM:SS" only changes once a second */
+		static char str[sizeof("HH:MM:SS")];
+		static time_t str_sec = -1;
+		struct timespec ts, dts;
+		static struct timespec ots;
 
-		gettimeofday(&tv, NULL);
+		clock_now(&ts);
 		if (rflag) {
-			if (otv.tv_sec == 0)
-				otv = tv;
-			tv_sub(&dtv, &tv, &otv);
-			tprintf("%6ld.%06ld ",
-				(long) dtv.tv_sec, (long) dtv.tv_usec);
-			otv = tv;
+			if (ots.tv_sec == 0)
+				ots = ts;
+			ts_sub(&dts, &ts, &ots);
+			tprint_timespec(&dts, 6);
+			ots = ts;
 		}
 		else if (tflag > 2) {
-			tprintf("%ld.%06ld ",
-				(long) tv.tv_sec, (long) tv.tv_usec);
+			tprint_timespec(&ts, 0);
 		}
 		else {
-			time_t local = tv.tv_sec;
-			strftime(str, sizeof(str), "%T", localtime(&local));
+			if (clock_id != CLOCK_REALTIME)
+				ts_add(&ts, &ts, &clock_offset);
+			if (ts.tv_sec != str_sec) {
+				time_t local = ts.tv_sec;
+
+				strftime(str, sizeof(str), "%T",
+					 localtime(&local));
+				str_sec = ts.tv_sec;
+			}
+			tprintn(str, sizeof(str) - 1);
 			if (tflag > 1)
-				tprintf("%s.%06ld ", str, (long) tv.tv_usec);
-			else
-				tprintf("%s ", str);
+				tprint_fraction(ts.tv_nsec);
 		}
+		tprints(" ");
 	}
 	if (iflag)
 		print_pc(tcp);
@@ -690,6 +1230,49 @@ newoutf(struct tcb *tcp)
 		char name[520 + sizeof(int) * 3];
 		sprintf(name, "%.512s.%u", outfname, tcp->pid);
 		tcp->outf = strace_fopen(name);
+		if (gzlog_level)
+			tcp->outf = gzlog_fopen(tcp->outf);
+		if (flightrec_size)
+			tcp->outf = flightrec_fopen(tcp->outf);
+		if (outbuf_size) {
+			tcp->outbuf = xmalloc(outbuf_size);
+			setvbuf(tcp->outf, tcp->outbuf, _IOFBF, outbuf_size);
+		}
+	}
+}
+
+/*
+ * The tcbs in use, by pid, for pid2tcb: tcb_hash has twice as many
+ * buckets as tcbtab has entries, each a list linked by pid_next.
+ */
+static struct tcb **tcb_hash;
+static unsigned int tcb_hash_mask;
+
+static struct tcb **
+tcb_bucket(int pid)
+{
+	return &tcb_hash[(unsigned int) pid & tcb_hash_mask];
+}
+
+static void
+tcb_hash_add(struct tcb *tcp)
+{
+	struct tcb **bucket = tcb_bucket(tcp->pid);
+
+	tcp->pid_next = *bucket;
+	*bucket = tcp;
+}
+
+static void
+tcb_hash_del(struct tcb *tcp)
+{
+	struct tcb **p;
+
+	for (p = tcb_bucket(tcp->pid); *p; p = &(*p)->pid_next) {
+		if (*p == tcp) {
+			*p = tcp->pid_next;
+			break;
+		}
 	}
 }
 
@@ -701,7 +1284,7 @@ expand_tcbtab(void)
 	   callers have pointers and it would be a pain.
 	   So tcbtab is a table of pointers.  Since we never
 	   free the TCBs, we allocate a single chunk of many.  */
-	unsigned int new_tcbtabsize, alloc_tcbtabsize;
+	unsigned int new_tcbtabsize, alloc_tcbtabsize, i;
 	struct tcb *newtcbs;
 
 	if (tcbtabsize) {
@@ -715,6 +1298,14 @@ expand_tcbtab(void)
 	tcbtab = xreallocarray(tcbtab, new_tcbtabsize, sizeof(tcbtab[0]));
 	while (tcbtabsize < new_tcbtabsize)
 		tcbtab[tcbtabsize++] = newtcbs++;
+
+	free(tcb_hash);
+	tcb_hash = xcalloc(tcbtabsize * 2, sizeof(tcb_hash[0]));
+	tcb_hash_mask = tcbtabsize * 2 - 1;
+	for (i = 0; i < tcbtabsize; i++) {
+		if (tcbtab[i]->pid)
+			tcb_hash_add(tcbtab[i]);
+	}
 }
 
 struct tcb *
@@ -731,6 +1322,7 @@ alloctcb(int pid)
 		if (!tcp->pid) {
 			memset(tcp, 0, sizeof(*tcp));
 			tcp->pid = pid;
+			tcb_hash_add(tcp);
 #if SUPPORTED_PERSONALITIES > 1
 			tcp->currpers = current_personality;
 #endif
@@ -789,12 +1381,23 @@ droptcb(struct tcb *tcp)
 
 	free_tcb_priv_data(tcp);
 
+	if (tcp->flags & TCB_REPEAT)
+		end_repeats(tcp);
+
 #ifdef USE_LIBUNWIND
 	if (stack_trace_enabled) {
 		unwind_tcb_fin(tcp);
 	}
 #endif
 
+	perftrace_drop(tcp);
+
+	end_deferred_line(tcp);
+	if (tcp->defer_fp) {
+		fclose(tcp->defer_fp);
+		free(tcp->defer_buf);
+	}
+
 	nprocs--;
 	if (debug_flag)
 		error_msg("dropped tcb for pid %d, %d remain",
@@ -804,7 +1407,10 @@ droptcb(struct tcb *tcp)
 		if (followfork >= 2) {
 			if (tcp->curcol != 0)
 				fprintf(tcp->outf, " <detached ...>\n");
+			if (flightrec_pending)
+				flightrec_dump_pending();
 			fclose(tcp->outf);
+			free(tcp->outbuf);
 		} else {
 			if (printing_tcp == tcp && tcp->curcol != 0)
 				fprintf(tcp->outf, " <detached ...>\n");
@@ -817,24 +1423,33 @@ droptcb(struct tcb *tcp)
 	if (printing_tcp == tcp)
 		printing_tcp = NULL;
 
+	tcb_hash_del(tcp);
 	memset(tcp, 0, sizeof(*tcp));
 }
 
-/* Detach traced process.
+/*
+ * Detaching from a traced process is done in two steps, so that
+ * cleanup can detach from all tracees without waiting for them one by one:
+ * detach_start detaches from TCP right away if it can, and if TCP has
+ * to be stopped first, tells it to stop and returns true;
+ * detach_stopped is then given the wait statuses of TCP until it
+ * returns true, and detach_done finishes with TCP.
+ *
  * Never call DETACH twice on the same process as both unattached and
  * attached-unstopped processes give the same ESRCH.  For unattached process we
  * would SIGSTOP it and wait for its SIGSTOP notification forever.
  */
-static void
-detach(struct tcb *tcp)
+static bool
+detach_start(struct tcb *tcp)
 {
 	int error;
-	int status;
 
 	if (gdbserver) {
 		gdb_detach(tcp);
-		goto drop;
+		return false;
 	}
+	if (backend != BACKEND_PTRACE)
+		return false;
 
 	/*
 	 * Linux wrongly insists the child be stopped
@@ -843,24 +1458,24 @@ detach(struct tcb *tcp)
 	 */
 
 	if (!(tcp->flags & TCB_ATTACHED))
-		goto drop;
+		return false;
 
 	/* We attached but possibly didn't see the expected SIGSTOP.
 	 * We must catch exactly one as otherwise the detached process
 	 * would be left stopped (process state T).
 	 */
 	if (tcp->flags & TCB_IGNORE_ONE_SIGSTOP)
-		goto wait_loop;
+		return true;
 
 	error = ptrace(PTRACE_DETACH, tcp->pid, 0, 0);
 	if (!error) {
 		/* On a clear day, you can see forever. */
-		goto drop;
+		return false;
 	}
 	if (errno != ESRCH) {
 		/* Shouldn't happen. */
 		perror_msg("detach: ptrace(PTRACE_DETACH,%u)", tcp->pid);
-		goto drop;
+		return false;
 	}
 	/* ESRCH: process is either not stopped or doesn't exist. */
 	if (my_tkill(tcp->pid, 0) < 0) {
@@ -868,7 +1483,7 @@ detach(struct tcb *tcp)
 			/* Shouldn't happen. */
 			perror_msg("detach: tkill(%u,0)", tcp->pid);
 		/* else: process doesn't exist. */
-		goto drop;
+		return false;
 	}
 	/* Process is not stopped, need to stop it. */
 	if (use_seize) {
@@ -880,113 +1495,134 @@ detach(struct tcb *tcp)
 		 */
 		error = ptrace(PTRACE_INTERRUPT, tcp->pid, 0, 0);
 		if (!error)
-			goto wait_loop;
+			return true;
 		if (errno != ESRCH)
 			perror_msg("detach: ptrace(PTRACE_INTERRUPT,%u)", tcp->pid);
 	}
 	else {
 		error = my_tkill(tcp->pid, SIGSTOP);
 		if (!error)
-			goto wait_loop;
+			return true;
 		if (errno != ESRCH)
 			perror_msg("detach: tkill(%u,SIGSTOP)", tcp->pid);
 	}
 	/* Either process doesn't exist, or some weird error. */
-	goto drop;
+	return false;
+}
 
- wait_loop:
-	/* We end up here in three cases:
-	 * 1. We sent PTRACE_INTERRUPT (use_seize case)
-	 * 2. We sent SIGSTOP (!use_seize)
-	 * 3. Attach SIGSTOP was already pending (TCB_IGNORE_ONE_SIGSTOP set)
-	 */
-	for (;;) {
-		unsigned int sig;
-		if (waitpid(tcp->pid, &status, __WALL) < 0) {
-			if (errno == EINTR)
-				continue;
-			/*
-			 * if (errno == ECHILD) break;
-			 * ^^^  WRONG! We expect this PID to exist,
-			 * and want to emit a message otherwise:
-			 */
-			perror_msg("detach: waitpid(%u)", tcp->pid);
-			break;
-		}
-		if (!WIFSTOPPED(status)) {
+/* We end up here in three cases:
+ * 1. We sent PTRACE_INTERRUPT (use_seize case)
+ * 2. We sent SIGSTOP (!use_seize)
+ * 3. Attach SIGSTOP was already pending (TCB_IGNORE_ONE_SIGSTOP set)
+ */
+static bool
+detach_stopped(struct tcb *tcp, int status)
+{
+	unsigned int sig;
+
+	if (!WIFSTOPPED(status)) {
+		/*
+		 * Tracee exited or was killed by signal.
+		 * We shouldn't normally reach this place:
+		 * we don't want to consume exit status.
+		 * Consider "strace -p PID" being ^C-ed:
+		 * we want merely to detach from PID.
+		 *
+		 * However, we _can_ end up here if tracee
+		 * was SIGKILLed.
+		 */
+		return true;
+	}
+	sig = WSTOPSIG(status);
+	if (debug_flag)
+		error_msg("detach wait: event:%d sig:%d",
+			  (unsigned)status >> 16, sig);
+	if (use_seize) {
+		unsigned event = (unsigned)status >> 16;
+		if (event == PTRACE_EVENT_STOP /*&& sig == SIGTRAP*/) {
 			/*
-			 * Tracee exited or was killed by signal.
-			 * We shouldn't normally reach this place:
-			 * we don't want to consume exit status.
-			 * Consider "strace -p PID" being ^C-ed:
-			 * we want merely to detach from PID.
-			 *
-			 * However, we _can_ end up here if tracee
-			 * was SIGKILLed.
+			 * sig == SIGTRAP: PTRACE_INTERRUPT stop.
+			 * sig == other: process was already stopped
+			 * with this stopping sig (see tests/detach-stopped).
+			 * Looks like re-injecting this sig is not necessary
+			 * in DETACH for the tracee to remain stopped.
 			 */
-			break;
-		}
-		sig = WSTOPSIG(status);
-		if (debug_flag)
-			error_msg("detach wait: event:%d sig:%d",
-				  (unsigned)status >> 16, sig);
-		if (use_seize) {
-			unsigned event = (unsigned)status >> 16;
-			if (event == PTRACE_EVENT_STOP /*&& sig == SIGTRAP*/) {
-				/*
-				 * sig == SIGTRAP: PTRACE_INTERRUPT stop.
-				 * sig == other: process was already stopped
-				 * with this stopping sig (see tests/detach-stopped).
-				 * Looks like re-injecting this sig is not necessary
-				 * in DETACH for the tracee to remain stopped.
-				 */
-				sig = 0;
-			}
-			/*
-			 * PTRACE_INTERRUPT is not guaranteed to produce
-			 * the above event if other ptrace-stop is pending.
-			 * See tests/detach-sleeping testcase:
-			 * strace got SIGINT while tracee is sleeping.
-			 * We sent PTRACE_INTERRUPT.
-			 * We see syscall exit, not PTRACE_INTERRUPT stop.
-			 * We won't get PTRACE_INTERRUPT stop
-			 * if we would CONT now. Need to DETACH.
-			 */
-			if (sig == syscall_trap_sig)
-				sig = 0;
-			/* else: not sure in which case we can be here.
-			 * Signal stop? Inject it while detaching.
-			 */
-			ptrace_restart(PTRACE_DETACH, tcp, sig);
-			break;
-		}
-		/* Note: this check has to be after use_seize check */
-		/* (else, in use_seize case SIGSTOP will be mistreated) */
-		if (sig == SIGSTOP) {
-			/* Detach, suppressing SIGSTOP */
-			ptrace_restart(PTRACE_DETACH, tcp, 0);
-			break;
+			sig = 0;
 		}
+		/*
+		 * PTRACE_INTERRUPT is not guaranteed to produce
+		 * the above event if other ptrace-stop is pending.
+		 * See tests/detach-sleeping testcase:
+		 * strace got SIGINT while tracee is sleeping.
+		 * We sent PTRACE_INTERRUPT.
+		 * We see syscall exit, not PTRACE_INTERRUPT stop.
+		 * We won't get PTRACE_INTERRUPT stop
+		 * if we would CONT now. Need to DETACH.
+		 */
 		if (sig == syscall_trap_sig)
 			sig = 0;
-		/* Can't detach just yet, may need to wait for SIGSTOP */
-		error = ptrace_restart(PTRACE_CONT, tcp, sig);
-		if (error < 0) {
-			/* Should not happen.
-			 * Note: ptrace_restart returns 0 on ESRCH, so it's not it.
-			 * ptrace_restart already emitted error message.
-			 */
-			break;
-		}
+		/* else: not sure in which case we can be here.
+		 * Signal stop? Inject it while detaching.
+		 */
+		ptrace_restart(PTRACE_DETACH, tcp, sig);
+		return true;
 	}
+	/* Note: this check has to be after use_seize check */
+	/* (else, in use_seize case SIGSTOP will be mistreated) */
+	if (sig == SIGSTOP) {
+		/* Detach, suppressing SIGSTOP */
+		ptrace_restart(PTRACE_DETACH, tcp, 0);
+		return true;
+	}
+	if (sig == syscall_trap_sig)
+		sig = 0;
+	/* Can't detach just yet, may need to wait for SIGSTOP */
+	if (ptrace_restart(PTRACE_CONT, tcp, sig) < 0) {
+		/* Should not happen.
+		 * Note: ptrace_restart returns 0 on ESRCH, so it's not it.
+		 * ptrace_restart already emitted error message.
+		 */
+		return true;
+	}
+	return false;
+}
 
- drop:
+static void
+detach_done(struct tcb *tcp)
+{
 	if (!qflag && (tcp->flags & TCB_ATTACHED))
 		error_msg("Process %u detached", tcp->pid);
 
 	droptcb(tcp);
 }
 
+/* Detach traced process.  */
+static void
+detach(struct tcb *tcp)
+{
+	int status;
+
+	if (detach_start(tcp)) {
+		for (;;) {
+			if (waitpid(tcp->pid, &status, __WALL) < 0) {
+				if (errno == EINTR)
+					continue;
+				/*
+				 * if (errno == ECHILD) break;
+				 * ^^^  WRONG! We expect this PID to exist,
+				 * and want to emit a message otherwise:
+				 */
+				perror_msg("detach: waitpid(%u)", tcp->pid);
+				break;
+			}
+			if (detach_stopped(tcp, status))
+				break;
+		}
+	}
+
+	detach_done(tcp);
+}
+
 static void
 process_opt_p_list(char *opt)
 {
@@ -1015,12 +1651,147 @@ process_opt_p_list(char *opt)
 	}
 }
 
+/*
+ * Start watching TCP with a backend that does not stop it.
+ * Return 0 on success, -1 with errno set on failure.
+ */
+static int
+backend_add(struct tcb *tcp)
+{
+	if (backend == BACKEND_PERF)
+		return perftrace_add(tcp);
+	bpfcount_add(tcp->pid);
+	return 0;
+}
+
+#ifndef W_EXITCODE
+# define W_EXITCODE(ret, sig)	((ret) << 8 | (sig))
+#endif
+
+/*
+ * With -X perf or seccomp, report the end of TCP, which is gone,
+ * and forget it.
+ */
+void
+backend_gone(struct tcb *tcp)
+{
+	int status = -1;
+
+	if (tcp->pid == strace_child) {
+		if (waitpid(strace_child, &status, __WALL) < 0)
+			status = -1;
+	} else if (exiting(tcp) && tcp->s_ent && tcp->s_ent->sen == SEN_exit) {
+		status = W_EXITCODE(tcp->u_arg[0] & 0xff, 0);
+	}
+
+	if (status != -1) {
+		if (WIFSIGNALED(status))
+			print_signalled(tcp, tcp->pid, status);
+		else
+			print_exited(tcp, tcp->pid, status);
+	}
+	droptcb(tcp);
+}
+
+/* Whether TID is traced by us, e.g. as a clone of an attached thread.  */
+static bool
+traced_by_us(int tid)
+{
+	char path[sizeof("/proc/%d/status") + sizeof(int) * 3];
+	char line[64];
+	FILE *fp;
+	int tracer = 0;
+
+	sprintf(path, "/proc/%d/status", tid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return false;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "TracerPid: %d", &tracer) == 1)
+			break;
+	}
+	fclose(fp);
+
+	return tracer == strace_tracer_pid;
+}
+
+/*
+ * Attach to the threads of process PID that have no tcb yet.
+ * Returns how many there were.
+ */
+static unsigned int
+attach_threads(int pid)
+{
+	char procdir[sizeof("/proc/%d/task") + sizeof(int) * 3];
+	DIR *dir;
+	struct_dirent *de;
+	unsigned int n = 0;
+
+	sprintf(procdir, "/proc/%d/task", pid);
+	dir = opendir(procdir);
+	if (!dir)
+		return 0;
+
+	while ((de = read_dir(dir)) != NULL) {
+		if (de->d_fileno == 0)
+			continue;
+
+		int tid = string_to_uint(de->d_name);
+		if (tid <= 0 || pid2tcb(tid))
+			continue;
+
+		struct snapshot *snap =
+			snapshot_flag ? snapshot_read(tid) : NULL;
+		struct tcb *tid_tcp = alloctcb(tid);
+		if (backend != BACKEND_PTRACE
+		    ? backend_add(tid_tcp) < 0
+		    : ptrace_attach_or_seize(tid) < 0) {
+			if (backend != BACKEND_PTRACE || errno != EPERM ||
+			    !traced_by_us(tid)) {
+				if (debug_flag)
+					perror_msg("attach: ptrace(%s, %d)",
+						   ptrace_attach_cmd, tid);
+				snapshot_free(snap);
+				droptcb(tid_tcp);
+				continue;
+			}
+			/* Its stop is yet to come, as for any new child.  */
+			if (debug_flag)
+				error_msg("pid %d is attached already", tid);
+		} else if (debug_flag) {
+			error_msg("attach to pid %d succeeded", tid);
+		}
+
+		tid_tcp->flags |= TCB_ATTACHED | TCB_STARTUP |
+				  post_attach_sigstop;
+		newoutf(tid_tcp);
+		if (snap)
+			snapshot_print(tid_tcp, snap);
+		++n;
+	}
+
+	closedir(dir);
+	return n;
+}
+
 static void
 attach_tcb(struct tcb *const tcp)
 {
-	if (ptrace_attach_or_seize(tcp->pid) < 0) {
+	/* Attaching interrupts the syscall, look at it before.  */
+	struct snapshot *snap = snapshot_flag && tcp->pid != strace_child
+				? snapshot_read(tcp->pid) : NULL;
+
+	if (backend != BACKEND_PTRACE) {
+		if (backend_add(tcp) < 0) {
+			perror_msg("attach: perf_event_open(%d)", tcp->pid);
+			snapshot_free(snap);
+			droptcb(tcp);
+			return;
+		}
+	} else if (ptrace_attach_or_seize(tcp->pid) < 0) {
 		perror_msg("attach: ptrace(%s, %d)",
 			   ptrace_attach_cmd, tcp->pid);
+		snapshot_free(snap);
 		droptcb(tcp);
 		return;
 	}
@@ -1030,52 +1801,168 @@ attach_tcb(struct tcb *const tcp)
 	if (debug_flag)
 		error_msg("attach to pid %d (main) succeeded", tcp->pid);
 
+	unsigned int nthreads = 0;
+
+	/* With -j, the threads have been split among the tracers.  */
+	if (followfork && ntracers == 1 && tcp->pid != strace_child) {
+		struct timespec start, now;
+		unsigned int rounds = 0, n;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		/*
+		 * Threads started by a thread we have attached to are
+		 * attached by the kernel, but those started by the others
+		 * while we go through the list are not in it: go through
+		 * it again until there is nothing new.
+		 */
+		do {
+			n = attach_threads(tcp->pid);
+			nthreads += n;
+			++rounds;
+		} while (n);
+		if (debug_flag) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ts_sub(&now, &now, &start);
+			error_msg("attach to %u threads of pid %d"
+				  " took %u rounds, %ld.%06ld seconds",
+				  nthreads, tcp->pid, rounds,
+				  (long) now.tv_sec, (long) now.tv_nsec / 1000);
+		}
+	}
+
+	/* Printed last, so that it gets a pid prefix if the threads do.  */
+	if (snap)
+		snapshot_print(tcp, snap);
+
+	if (qflag)
+		return;
+	if (nthreads)
+		error_msg("Process %u attached with %u threads",
+			  tcp->pid, nthreads + 1);
+	else
+		error_msg("Process %u attached", tcp->pid);
+}
+
+/* Add the threads of process PID to TIDS, or just PID without -f.  */
+static void
+add_tids(int pid, int **tids, unsigned int *ntids)
+{
 	char procdir[sizeof("/proc/%d/task") + sizeof(int) * 3];
-	DIR *dir;
-	unsigned int ntid = 0, nerr = 0;
+	DIR *dir = NULL;
+	struct_dirent *de;
 
-	if (followfork && tcp->pid != strace_child &&
-	    sprintf(procdir, "/proc/%d/task", tcp->pid) > 0 &&
-	    (dir = opendir(procdir)) != NULL) {
-		struct_dirent *de;
+	if (followfork) {
+		sprintf(procdir, "/proc/%d/task", pid);
+		dir = opendir(procdir);
+	}
+	if (!dir) {
+		*tids = xreallocarray(*tids, *ntids + 1, sizeof(**tids));
+		(*tids)[(*ntids)++] = pid;
+		return;
+	}
+	while ((de = read_dir(dir)) != NULL) {
+		int tid = string_to_uint(de->d_name);
 
-		while ((de = read_dir(dir)) != NULL) {
-			if (de->d_fileno == 0)
-				continue;
+		if (de->d_fileno == 0 || tid <= 0)
+			continue;
+		*tids = xreallocarray(*tids, *ntids + 1, sizeof(**tids));
+		(*tids)[(*ntids)++] = tid;
+	}
+	closedir(dir);
+}
 
-			int tid = string_to_uint(de->d_name);
-			if (tid <= 0 || tid == tcp->pid)
-				continue;
+/*
+ * Wait for the tracer processes started by shard_tracees,
+ * passing on the fatal signals we get, and exit like the worst of them.
+ */
+static void ATTRIBUTE_NORETURN
+wait_for_tracers(pid_t *pids, unsigned int n)
+{
+	unsigned int running = n, i;
+	int status, code = 0;
+	pid_t pid;
 
-			++ntid;
-			if (ptrace_attach_or_seize(tid) < 0) {
-				++nerr;
-				if (debug_flag)
-					perror_msg("attach: ptrace(%s, %d)",
-						   ptrace_attach_cmd, tid);
-				continue;
+	while (running) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno != EINTR)
+				perror_msg_and_die("waitpid");
+			if (interrupted) {
+				for (i = 0; i < n; ++i)
+					if (pids[i])
+						kill(pids[i], interrupted);
+				interrupted = 0;
 			}
-			if (debug_flag)
-				error_msg("attach to pid %d succeeded", tid);
-
-			struct tcb *tid_tcp = alloctcb(tid);
-			tid_tcp->flags |= TCB_ATTACHED | TCB_STARTUP |
-					  post_attach_sigstop;
-			newoutf(tid_tcp);
+			continue;
+		}
+		for (i = 0; i < n; ++i) {
+			if (pids[i] != pid)
+				continue;
+			pids[i] = 0;
+			--running;
+			if (WIFSIGNALED(status))
+				code = 1;
+			else if (WEXITSTATUS(status) > code)
+				code = WEXITSTATUS(status);
 		}
+	}
 
-		closedir(dir);
+	if (shared_log != stderr)
+		fclose(shared_log);
+	if (popen_pid) {
+		while (waitpid(popen_pid, NULL, 0) < 0 && errno == EINTR)
+			;
 	}
+	exit(code);
+}
 
-	if (!qflag) {
-		if (ntid > nerr)
-			error_msg("Process %u attached"
-				  " with %u threads",
-				  tcp->pid, ntid - nerr + 1);
-		else
-			error_msg("Process %u attached",
-				  tcp->pid);
+/*
+ * With -j, split the tracees given with -p, thread by thread with -f,
+ * among NTRACERS processes.  ptrace binds a tracee to its tracer and
+ * new children are attached by the tracer of their parent, so each
+ * process runs the usual trace loop on its shard, with its own tcbs
+ * and decoder state.  They share the output file; as each line is
+ * written at once (which is why -B needs -ff here), lines of
+ * different tracers do not mix.
+ * This process only waits for them.
+ */
+static void
+shard_tracees(void)
+{
+	int *tids = NULL;
+	unsigned int ntids = 0, shard, i;
+	pid_t *pids;
+
+	for (i = 0; i < tcbtabsize; ++i) {
+		struct tcb *tcp = tcbtab[i];
+
+		if (!tcp->pid)
+			continue;
+		add_tids(tcp->pid, &tids, &ntids);
+		droptcb(tcp);
+	}
+	if (ntracers > ntids)
+		ntracers = ntids;
+
+	pids = xcalloc(ntracers, sizeof(*pids));
+	for (shard = 0; shard < ntracers; ++shard) {
+		pids[shard] = fork();
+		if (pids[shard] < 0)
+			perror_msg_and_die("fork");
+		if (pids[shard] == 0)
+			break;
 	}
+	if (shard == ntracers)
+		wait_for_tracers(pids, ntracers);
+
+	free(pids);
+	strace_tracer_pid = getpid();
+	for (i = shard; i < ntids; i += ntracers)
+		alloctcb(tids[i]);
+	free(tids);
+	if (debug_flag)
+		error_msg("tracer %u of %u has %u tracees",
+			  shard + 1, ntracers, nprocs);
 }
 
 static void
@@ -1178,7 +2065,7 @@ exec_or_die(void)
 
 	if (params->fd_to_close >= 0)
 		close(params->fd_to_close);
-	if (!daemonized_tracer && !use_seize) {
+	if (!daemonized_tracer && !use_seize && backend == BACKEND_PTRACE) {
 		if (ptrace(PTRACE_TRACEME, 0L, 0L, 0L) < 0) {
 			perror_msg_and_die("ptrace(PTRACE_TRACEME, ...)");
 		}
@@ -1204,7 +2091,13 @@ exec_or_die(void)
 			perror_msg_and_die("setreuid");
 		}
 
-	if (!daemonized_tracer) {
+	if (backend == BACKEND_SECCOMP) {
+		/*
+		 * The tracer takes the listener over
+		 * while the execve below waits for it.
+		 */
+		seccomptrace_install();
+	} else if (!daemonized_tracer) {
 		/*
 		 * Induce a ptrace stop. Tracer (our parent)
 		 * will resume us with PTRACE_SYSCALL and display
@@ -1400,7 +2293,13 @@ startup_child(char **argv)
 
 	if (!daemonized_tracer) {
 		strace_child = pid;
-		if (!use_seize) {
+		tcp = alloctcb(pid);
+		if (backend == BACKEND_SECCOMP) {
+			if (seccomptrace_attach(pid) < 0) {
+				kill_save_errno(pid, SIGKILL);
+				perror_msg_and_die("attach: pidfd_getfd(%d)", pid);
+			}
+		} else if (!use_seize && backend == BACKEND_PTRACE) {
 			/* child did PTRACE_TRACEME, nothing to do in parent */
 		} else {
 			if (!NOMMU_SYSTEM) {
@@ -1421,7 +2320,13 @@ startup_child(char **argv)
 			 * This means that we may miss a few first syscalls...
 			 */
 
-			if (ptrace_attach_or_seize(pid)) {
+			if (backend != BACKEND_PTRACE) {
+				if (backend_add(tcp) < 0) {
+					kill_save_errno(pid, SIGKILL);
+					perror_msg_and_die("attach: perf_event_open(%d)",
+							   pid);
+				}
+			} else if (ptrace_attach_or_seize(pid)) {
 				kill_save_errno(pid, SIGKILL);
 				perror_msg_and_die("attach: ptrace(%s, %d)",
 						   ptrace_attach_cmd, pid);
@@ -1429,7 +2334,6 @@ startup_child(char **argv)
 			if (!NOMMU_SYSTEM)
 				kill(pid, SIGCONT);
 		}
-		tcp = alloctcb(pid);
 		if (!NOMMU_SYSTEM)
 			tcp->flags |= TCB_ATTACHED | TCB_STARTUP | post_attach_sigstop;
 		else
@@ -1567,6 +2471,50 @@ get_os_release(void)
 	return rel;
 }
 
+/* Parse the SIZE[,MSEC] argument of -B.  */
+static void
+parse_outbuf_opt(const char *arg)
+{
+	char *size = xstrdup(arg);
+	char *interval = strchr(size, ',');
+	int i;
+
+	if (interval)
+		*interval++ = '\0';
+	i = string_to_uint(size);
+	if (i <= 0)
+		error_opt_arg('B', arg);
+	outbuf_size = i;
+	if (interval) {
+		i = string_to_uint(interval);
+		if (i <= 0)
+			error_opt_arg('B', arg);
+		outbuf_interval = i;
+	}
+	free(size);
+}
+
+/* Parse the WINDOW,PERIOD argument of -A.  */
+static int
+parse_duty_cycle(const char *arg)
+{
+	char *window = xstrdup(arg);
+	char *period = strchr(window, ',');
+	int rc = -1;
+
+	if (period) {
+		*period++ = '\0';
+		if (parse_duration(window, &duty_window) == 0 &&
+		    parse_duration(period, &duty_period) == 0 &&
+		    (duty_window.tv_sec || duty_window.tv_nsec) &&
+		    ts_cmp(&duty_window, &duty_period) < 0)
+			rc = 0;
+	}
+	free(window);
+
+	return rc;
+}
+
 /*
  * Initialization part of main() was eating much stack (~0.5k),
  * which was unused after init.
@@ -1606,7 +2554,7 @@ init(int argc, char *argv[])
 #endif
 	qualify("signal=all");
 	while ((c = getopt(argc, argv,
-		"+b:cCdfFhiqrtTvVwxyz"
+		"+A:b:B:cCdfFg:hHij:JK:L:qrR:tTUvVwW:xX:yzZ"
 #ifdef USE_LIBUNWIND
 		"k"
 #endif
@@ -1620,6 +2568,26 @@ init(int argc, char *argv[])
 					optarg);
 			detach_on_execve = 1;
 			break;
+		case 'B':
+			parse_outbuf_opt(optarg);
+			break;
+		case 'R':
+			if (flightrec_option(optarg) < 0)
+				error_opt_arg(c, optarg);
+			break;
+		case 'L':
+			if (gzlog_option(optarg) < 0)
+				error_opt_arg(c, optarg);
+			break;
+		case 'K':
+			if (strcmp(optarg, "realtime") == 0)
+				clock_id = CLOCK_REALTIME;
+			else if (strcmp(optarg, "monotonic") == 0)
+				clock_id = CLOCK_MONOTONIC;
+			else
+				error_opt_arg(c, optarg);
+			clock_nsec = true;
+			break;
 		case 'c':
 			if (cflag == CFLAG_BOTH) {
 				error_msg_and_help("-c and -C are mutually exclusive");
@@ -1647,6 +2615,18 @@ init(int argc, char *argv[])
 		case 'G':
 			gdbserver = strdup(optarg);
 			break;
+		case 'X':
+			if (strcmp(optarg, "ptrace") == 0)
+				backend = BACKEND_PTRACE;
+			else if (strcmp(optarg, "bpf") == 0)
+				backend = BACKEND_BPF;
+			else if (strcmp(optarg, "perf") == 0)
+				backend = BACKEND_PERF;
+			else if (strcmp(optarg, "seccomp") == 0)
+				backend = BACKEND_SECCOMP;
+			else
+				error_opt_arg(c, optarg);
+			break;
 		case 'h':
 			usage();
 			break;
@@ -1681,9 +2661,21 @@ init(int argc, char *argv[])
 			printf("%s -- version %s\n", PACKAGE_NAME, VERSION);
 			exit(0);
 			break;
+		case 'J':
+			json_output = true;
+			break;
+		case 'U':
+			collapse_repeats = true;
+			break;
+		case 'W':
+			coltrace_open(optarg);
+			break;
 		case 'z':
 			not_failing_only = 1;
 			break;
+		case 'Z':
+			failing_only = 1;
+			break;
 		case 'a':
 			acolumn = string_to_uint(optarg);
 			if (acolumn < 0)
@@ -1728,6 +2720,23 @@ init(int argc, char *argv[])
 			if (putenv(optarg) < 0)
 				die_out_of_memory();
 			break;
+		case 'A':
+			if (parse_duty_cycle(optarg) < 0)
+				error_opt_arg(c, optarg);
+			break;
+		case 'g':
+			if (governor_option(optarg) < 0)
+				error_opt_arg(c, optarg);
+			break;
+		case 'H':
+			snapshot_flag++;
+			break;
+		case 'j':
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_opt_arg(c, optarg);
+			ntracers = i;
+			break;
 		case 'I':
 			opt_intr = string_to_uint(optarg);
 			if (opt_intr <= 0 || opt_intr >= NUM_INTR_OPTS)
@@ -1772,10 +2781,159 @@ init(int argc, char *argv[])
 	   }
 	}
 
+	if (not_failing_only && failing_only) {
+		error_msg_and_help("-z and -Z are mutually exclusive");
+	}
+
 	if (followfork >= 2 && cflag) {
 		error_msg_and_help("(-c or -C) and -ff are mutually exclusive");
 	}
 
+	if (json_output && cflag) {
+		error_msg_and_help("(-c or -C) and -J are mutually exclusive");
+	}
+
+	if (gzlog_level && !outfname) {
+		error_msg_and_help("-L requires -o");
+	}
+
+	/* Only the syscalls that are printed are recorded.  */
+	if (coltrace_fp && cflag == CFLAG_ONLY_STATS) {
+		error_msg_and_help("-c and -W are mutually exclusive");
+	}
+
+	if (governor_enabled()) {
+		if (cflag == CFLAG_ONLY_STATS)
+			error_msg_and_help("-c and -g are mutually exclusive");
+		if (gdbserver)
+			error_msg_and_help("-G and -g are mutually exclusive");
+		if (backend != BACKEND_PTRACE)
+			error_msg_and_help("-X and -g are mutually exclusive");
+		if (json_output)
+			error_msg_and_help("-g and -J are mutually exclusive");
+	}
+
+	if (duty_window.tv_sec || duty_window.tv_nsec) {
+		if (argv[0] || !nprocs)
+			error_msg_and_help("-A requires -p and no PROG");
+		if (gdbserver)
+			error_msg_and_help("-A and -G are mutually exclusive");
+		if (backend != BACKEND_PTRACE)
+			error_msg_and_help("-A and -X are mutually exclusive");
+		if (ntracers > 1)
+			error_msg_and_help("-A and -j are mutually exclusive");
+		if (flightrec_size)
+			error_msg_and_help("-A and -R are mutually exclusive");
+		if (snapshot_flag > 1)
+			error_msg_and_help("-A and -HH are mutually exclusive");
+		duty_pids = xcalloc(nprocs, sizeof(*duty_pids));
+		for (i = 0; i < (int) tcbtabsize; ++i) {
+			if (tcbtab[i]->pid)
+				duty_pids[duty_npids++] = tcbtab[i]->pid;
+		}
+	}
+
+	if (snapshot_flag) {
+		if (argv[0] || !nprocs)
+			error_msg_and_help("-H requires -p and no PROG");
+		if (cflag == CFLAG_ONLY_STATS)
+			error_msg_and_help("-c and -H are mutually exclusive");
+		if (json_output)
+			error_msg_and_help("-H and -J are mutually exclusive");
+		if (gdbserver)
+			error_msg_and_help("-G and -H are mutually exclusive");
+#ifdef USE_LIBUNWIND
+		if (stack_trace_enabled)
+			error_msg_and_help("-H and -k are mutually exclusive");
+#endif
+	}
+
+	if (ntracers > 1) {
+		if (argv[0] || !nprocs)
+			error_msg_and_help("-j requires -p and no PROG");
+		if (cflag)
+			error_msg_and_help("(-c or -C) and -j are mutually exclusive");
+		if (gdbserver)
+			error_msg_and_help("-G and -j are mutually exclusive");
+		if (backend != BACKEND_PTRACE)
+			error_msg_and_help("-X and -j are mutually exclusive");
+		if (flightrec_size)
+			error_msg_and_help("-R and -j are mutually exclusive");
+		if (gzlog_level)
+			error_msg_and_help("-L and -j are mutually exclusive");
+		if (coltrace_fp)
+			error_msg_and_help("-W and -j are mutually exclusive");
+		/* -B would write the shared file mid-line.  */
+		if (outbuf_size && followfork < 2)
+			error_msg_and_help("-B and -j are mutually exclusive"
+					   " without -ff");
+	}
+
+	if (backend == BACKEND_BPF) {
+		if (cflag != CFLAG_ONLY_STATS)
+			error_msg_and_help("-X bpf requires -c");
+		if (gdbserver)
+			error_msg_and_help("-G and -X bpf are mutually exclusive");
+		if (daemonized_tracer)
+			error_msg_and_help("-D and -X bpf are mutually exclusive");
+		if (tracing_paths)
+			error_msg_and_help("-P and -X bpf are mutually exclusive");
+		if (detach_on_execve)
+			error_msg_and_help("-b and -X bpf are mutually exclusive");
+		if (bpfcount_init() < 0) {
+			error_msg("-X bpf is not available, using ptrace");
+			backend = BACKEND_PTRACE;
+		}
+	}
+
+	if (backend == BACKEND_PERF) {
+		if (gdbserver)
+			error_msg_and_help("-G and -X perf are mutually exclusive");
+		if (daemonized_tracer)
+			error_msg_and_help("-D and -X perf are mutually exclusive");
+		if (detach_on_execve)
+			error_msg_and_help("-b and -X perf are mutually exclusive");
+		if (iflag)
+			error_msg_and_help("-i and -X perf are mutually exclusive");
+#ifdef USE_LIBUNWIND
+		if (stack_trace_enabled)
+			error_msg_and_help("-k and -X perf are mutually exclusive");
+#endif
+		if (perftrace_init() < 0) {
+			error_msg("-X perf is not available, using ptrace");
+			backend = BACKEND_PTRACE;
+		}
+	}
+
+	if (backend == BACKEND_SECCOMP) {
+		if (nprocs)
+			error_msg_and_help("-p and -X seccomp are mutually exclusive");
+		if (gdbserver)
+			error_msg_and_help("-G and -X seccomp are mutually exclusive");
+		if (daemonized_tracer)
+			error_msg_and_help("-D and -X seccomp are mutually exclusive");
+		if (detach_on_execve)
+			error_msg_and_help("-b and -X seccomp are mutually exclusive");
+		if (iflag)
+			error_msg_and_help("-i and -X seccomp are mutually exclusive");
+#ifdef USE_LIBUNWIND
+		if (stack_trace_enabled)
+			error_msg_and_help("-k and -X seccomp are mutually exclusive");
+#endif
+		if (seccomptrace_init() < 0) {
+			error_msg("-X seccomp is not available, using ptrace");
+			backend = BACKEND_PTRACE;
+		}
+	}
+
+	if (clock_id != CLOCK_REALTIME) {
+		struct timespec rt, ct;
+
+		clock_gettime(CLOCK_REALTIME, &rt);
+		clock_gettime(clock_id, &ct);
+		ts_sub(&clock_offset, &rt, &ct);
+	}
+
 	if (count_wallclock && !cflag) {
 		error_msg_and_help("-w must be given with (-c or -C)");
 	}
@@ -1859,13 +3017,23 @@ init(int argc, char *argv[])
 		}
 		else if (followfork < 2)
 			shared_log = strace_fopen(outfname);
+		if (gzlog_level && followfork < 2)
+			shared_log = gzlog_fopen(shared_log);
 	} else {
 		/* -ff without -o FILE is the same as single -f */
 		if (followfork >= 2)
 			followfork = 1;
 	}
+	if (flightrec_size && followfork < 2)
+		shared_log = flightrec_fopen(shared_log);
 
-	if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
+	if (outbuf_size) {
+		if (followfork < 2 || !outfname) {
+			char *buf = xmalloc(outbuf_size);
+			setvbuf(shared_log, buf, _IOFBF, outbuf_size);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &outbuf_flushed);
+	} else if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
 		char *buf = xmalloc(BUFSIZ);
 		setvbuf(shared_log, buf, _IOLBF, BUFSIZ);
 	}
@@ -1929,8 +3097,46 @@ init(int argc, char *argv[])
 		sigaction(SIGPIPE, &sa, NULL);
 		sigaction(SIGTERM, &sa, NULL);
 	}
+	if (flightrec_size) {
+		/*
+		 * With ptrace, SIGUSR1 is only let in while waiting for
+		 * the next stop, the same way fatal signals are handled
+		 * in interactive mode.
+		 */
+		sa.sa_handler = flightrec_request;
+		sa.sa_flags = gdbserver ? SA_RESTART : 0;
+		sigaction(SIGUSR1, &sa, NULL);
+		if (!gdbserver) {
+			sigaddset(&blocked_set, SIGUSR1);
+			sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+		}
+	}
+	/* See wait_for_stop.  */
+	sigwait_stops = (interactive || flightrec_size || duty_npids ||
+			 outbuf_interval) &&
+			backend == BACKEND_PTRACE && !gdbserver;
+	if (sigwait_stops)
+		sigaddset(&blocked_set, SIGCHLD);
+	measure_syscall_time = Tflag || cflag || collapse_repeats ||
+		json_output || coltrace_fp || governor_enabled() ||
+		flightrec_latency.tv_sec || flightrec_latency.tv_nsec ||
+		latency_min.tv_sec || latency_min.tv_nsec;
+	defer_lines = not_failing_only || failing_only || status_filter ||
+		collapse_repeats || json_output ||
+		latency_min.tv_sec || latency_min.tv_nsec;
+	if (governor_enabled())
+		governor_init();
+	if (ntracers > 1)
+		shard_tracees();
 	if (nprocs != 0 || daemonized_tracer)
 		startup_attach();
+	if (sigwait_stops)
+		sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+	if (duty_npids) {
+		clock_gettime(CLOCK_MONOTONIC, &duty_start);
+		duty_begin = duty_start;
+		ts_add(&duty_end, &duty_begin, &duty_window);
+	}
 
 	if (gdbserver)
 		gdb_finalize_init();
@@ -1940,19 +3146,19 @@ init(int argc, char *argv[])
 	 * -f: yes (there can be more pids in the future); or
 	 * -p PID1,PID2: yes (there are already more than one pid)
 	 */
-	print_pid_pfx = (outfname && followfork < 2 && (followfork == 1 || nprocs > 1));
+	print_pid_pfx = (outfname && followfork < 2 &&
+			 (followfork == 1 || nprocs > 1 || ntracers > 1));
 }
 
 struct tcb *
 pid2tcb(int pid)
 {
-	unsigned int i;
+	struct tcb *tcp;
 
-	if (pid <= 0)
+	if (pid <= 0 || !tcb_hash)
 		return NULL;
 
-	for (i = 0; i < tcbtabsize; i++) {
-		struct tcb *tcp = tcbtab[i];
+	for (tcp = *tcb_bucket(pid); tcp; tcp = tcp->pid_next) {
 		if (tcp->pid == pid)
 			return tcp;
 	}
@@ -1960,18 +3166,19 @@ pid2tcb(int pid)
 	return NULL;
 }
 
+/*
+ * Detach from all tracees.  They are all told to stop before any of
+ * them is waited for, so that each is detached as soon as it stops.
+ * The program started by strace gets FATAL_SIG.
+ */
 static void
-cleanup(void)
+detach_all(int fatal_sig)
 {
-	unsigned int i;
+	unsigned int i, ndetached = 0, nstopping = 0;
+	struct timespec start, now;
 	struct tcb *tcp;
-	int fatal_sig;
-
-	/* 'interrupted' is a volatile object, fetch it only once */
-	fatal_sig = interrupted;
-	if (!fatal_sig)
-		fatal_sig = SIGTERM;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	for (i = 0; i < tcbtabsize; i++) {
 		tcp = tcbtab[i];
 		if (!tcp->pid)
@@ -1982,10 +3189,103 @@ cleanup(void)
 			kill(tcp->pid, SIGCONT);
 			kill(tcp->pid, fatal_sig);
 		}
-		detach(tcp);
+		++ndetached;
+		if (detach_start(tcp)) {
+			tcp->flags |= TCB_DETACHING;
+			++nstopping;
+		} else {
+			detach_done(tcp);
+		}
+	}
+	while (nstopping) {
+		int status;
+		int pid = wait4(-1, &status, __WALL, NULL);
+
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg("detach: wait4(__WALL)");
+			break;
+		}
+		tcp = pid2tcb(pid);
+		if (!tcp) {
+			/* A new child, attached by the kernel.  */
+			if (WIFSTOPPED(status))
+				ptrace(PTRACE_DETACH, pid, 0, 0);
+			continue;
+		}
+		if (!(tcp->flags & TCB_DETACHING) ||
+		    !detach_stopped(tcp, status))
+			continue;
+		detach_done(tcp);
+		--nstopping;
+	}
+	for (i = 0; nstopping && i < tcbtabsize; i++) {
+		tcp = tcbtab[i];
+		if (tcp->flags & TCB_DETACHING) {
+			detach_done(tcp);
+			--nstopping;
+		}
 	}
-	if (cflag)
+	if (debug_flag && ndetached) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ts_sub(&now, &now, &start);
+		error_msg("detach from %u tracees took %ld.%06ld seconds",
+			  ndetached, (long) now.tv_sec,
+			  (long) now.tv_nsec / 1000);
+	}
+}
+
+/*
+ * With -A, scale the -c counts up from the time traced
+ * to the whole time strace ran.
+ */
+static void
+duty_cycle_scale(void)
+{
+	struct timespec now, ts;
+	double traced, total;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* In a window, it ends now.  */
+	if (ts_cmp(&now, &duty_end) < 0) {
+		ts_sub(&ts, &now, &duty_begin);
+		ts_add(&duty_traced, &duty_traced, &ts);
+	}
+	ts_sub(&ts, &now, &duty_start);
+	traced = duty_traced.tv_sec + duty_traced.tv_nsec / 1e9;
+	total = ts.tv_sec + ts.tv_nsec / 1e9;
+	if (traced <= 0 || total <= traced)
+		return;
+
+	fprintf(shared_log, "Traced %.3f of %.3f seconds,"
+		" counts scaled by %.2f\n", traced, total, total / traced);
+	scale_counts(total / traced);
+}
+
+static void
+cleanup(void)
+{
+	int fatal_sig;
+
+	/* 'interrupted' is a volatile object, fetch it only once */
+	fatal_sig = interrupted;
+	if (!fatal_sig)
+		fatal_sig = SIGTERM;
+
+	/* Show what the tracees did up to now.  */
+	if (backend == BACKEND_PERF)
+		perftrace_decode(true);
+
+	detach_all(fatal_sig);
+	if (backend == BACKEND_BPF)
+		bpfcount_collect();
+	if (duty_npids && cflag)
+		duty_cycle_scale();
+	if (cflag || governor_counted)
 		call_summary(shared_log);
+	if (coltrace_fp)
+		coltrace_close();
 
 	gdb_cleanup();
 }
@@ -2081,6 +3381,7 @@ static struct tcb *
 maybe_switch_tcbs(struct tcb *tcp, const int pid)
 {
 	FILE *fp;
+	char *buf;
 	struct tcb *execve_thread;
 	long old_pid = 0;
 
@@ -2108,6 +3409,9 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	fp = execve_thread->outf;
 	execve_thread->outf = tcp->outf;
 	tcp->outf = fp;
+	buf = execve_thread->outbuf;
+	execve_thread->outbuf = tcp->outbuf;
+	tcp->outbuf = buf;
 	/* And their column positions */
 	execve_thread->curcol = tcp->curcol;
 	tcp->curcol = 0;
@@ -2115,7 +3419,9 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	droptcb(tcp);
 	/* Switch to the thread, reusing leader's outfile and pid */
 	tcp = execve_thread;
+	tcb_hash_del(tcp);
 	tcp->pid = pid;
+	tcb_hash_add(tcp);
 	if (cflag != CFLAG_ONLY_STATS) {
 		printleader(tcp);
 		tprintf("+++ superseded by execve in pid %lu +++\n", old_pid);
@@ -2134,6 +3440,10 @@ print_signalled(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
+	if (flightrec_size && flightrec_on_signal)
+		flightrec_trigger(tcp);
+
+	end_deferred_line(tcp);
 	if (cflag != CFLAG_ONLY_STATS
 	 && (qual_flags[WTERMSIG(status)] & QUAL_SIGNAL)
 	) {
@@ -2205,6 +3515,300 @@ startup_tcb(struct tcb *tcp)
 	}
 }
 
+/*
+ * Look for tracees that have gone away.  Those found gone in an earlier
+ * call are reported and forgotten, the others are just marked.
+ * Return true if some have been marked.
+ */
+static bool
+check_gone_tracees(void)
+{
+	bool marked = false;
+	unsigned int i;
+
+	for (i = 0; i < tcbtabsize; ++i) {
+		struct tcb *tcp = tcbtab[i];
+		siginfo_t si;
+		bool gone;
+
+		if (!tcp->pid)
+			continue;
+		if (tcp->pid == strace_child) {
+			si.si_pid = 0;
+			gone = waitid(P_PID, strace_child, &si,
+				      WEXITED | WNOHANG | WNOWAIT) == 0 &&
+			       si.si_pid;
+		} else {
+			gone = kill(tcp->pid, 0) < 0 && errno == ESRCH;
+		}
+		if (!gone)
+			continue;
+		if (tcp->flags & TCB_GONE) {
+			backend_gone(tcp);
+		} else {
+			tcp->flags |= TCB_GONE;
+			marked = true;
+		}
+	}
+
+	return marked;
+}
+
+/*
+ * With -X perf, tracees never stop either: decode what they did
+ * from the perf rings until all of them have gone.
+ */
+static bool
+read_perf_events(void)
+{
+	/*
+	 * The records of threads going away can be lost, too.  Once a
+	 * thread is gone, all it did is in the rings, so this round
+	 * decodes everything; if that does not end the thread,
+	 * the next round does.
+	 */
+	bool flush = check_gone_tracees();
+
+	if (!nprocs)
+		return false;
+
+	if (interactive)
+		sigprocmask(SIG_SETMASK, &empty_set, NULL);
+	perftrace_wait(100);
+	if (interactive)
+		sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+	perftrace_decode(flush);
+
+	return nprocs > 0;
+}
+
+/*
+ * With -X seccomp, tracees stop only in the traced syscalls, waiting
+ * for strace to answer.  Untraced descendants get notifications, too,
+ * so keep answering until nobody uses the filter.
+ */
+static bool
+read_seccomp_events(void)
+{
+	static const struct timespec check_interval = { 0, 100000000 };
+	static struct timespec next_check;
+	struct timespec now;
+	bool pending;
+
+	if (interactive)
+		sigprocmask(SIG_SETMASK, &empty_set, NULL);
+	pending = seccomptrace_wait(100);
+	if (interactive)
+		sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+
+	if (pending)
+		seccomptrace_decode();
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!pending || ts_cmp(&now, &next_check) >= 0) {
+		check_gone_tracees();
+		ts_add(&next_check, &now, &check_interval);
+	}
+
+	return nprocs > 0 || seccomptrace_alive();
+}
+
+/*
+ * With -X bpf, tracees never stop, so there are no events to handle:
+ * just wait for the traced processes to go away.
+ */
+static bool
+wait_for_tracees(void)
+{
+	static const struct timespec poll_interval = { 0, 100000000 };
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	if (strace_child) {
+		if (interactive)
+			sigprocmask(SIG_SETMASK, &empty_set, NULL);
+		pid = waitpid(strace_child, &status, __WALL);
+		if (interactive)
+			sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+		if (pid < 0) {
+			if (errno == EINTR)
+				return true;
+			perror_msg_and_die("waitpid");
+		}
+		if (WIFSIGNALED(status))
+			exit_code = 0x100 | WTERMSIG(status);
+		else if (WIFEXITED(status))
+			exit_code = WEXITSTATUS(status);
+		else
+			return true;
+		strace_child = 0;
+	}
+
+	/* Processes attached with -p, and with -f all the children.  */
+	for (i = 0; i < tcbtabsize; ++i) {
+		struct tcb *tcp = tcbtab[i];
+
+		if (tcp->pid && kill(tcp->pid, 0) < 0 && errno == ESRCH)
+			droptcb(tcp);
+	}
+	if (!bpfcount_alive())
+		return false;
+
+	if (interactive)
+		sigprocmask(SIG_SETMASK, &empty_set, NULL);
+	nanosleep(&poll_interval, NULL);
+	if (interactive)
+		sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+	return true;
+}
+
+/*
+ * When signals are let in only between stops, they stay blocked
+ * along with SIGCHLD, which the kernel sends to the tracer on every
+ * stop and exit of a tracee, and strace sleeps in sigwaitinfo.
+ * Once it has taken a SIGCHLD, strace reaps stops with a non-blocking
+ * wait4 until there are none left: signals sent for several stops
+ * are merged into one, and stops that come while it reaps send
+ * a SIGCHLD of their own, so the next sleep ends at once.
+ *
+ * With one tracee, that is sigwaitinfo, wait4, and the wait4 that
+ * finds nothing, per stop: three syscalls, as many as a blocking wait4
+ * between two sigprocmask calls.  With several busy tracees, one
+ * wakeup reaps the stops of many, and the cost comes close to one
+ * wait4 per stop.  Without signals to let in, strace blocks in wait4
+ * instead, which is one syscall per stop.
+ *
+ * The sleep is cut short when -B buffers are due to be written out.
+ * Returns what wait4 would, with EINTR when a signal came,
+ * and with EAGAIN when the -A window is over.
+ */
+static int
+wait_for_stop(int *status, struct rusage *ru)
+{
+	struct timespec now, ts, *timeout;
+	int pid;
+	int sig;
+
+	for (;;) {
+		if (stops_pending) {
+			pid = wait4(-1, status, __WALL | WNOHANG, ru);
+			if (pid != 0)
+				return pid;
+			stops_pending = false;
+		}
+
+		timeout = NULL;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (duty_npids) {
+			/* Not past the end of the -A window.  */
+			if (ts_cmp(&now, &duty_end) >= 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+			ts_sub(&ts, &duty_end, &now);
+			timeout = &ts;
+		}
+		if (outbuf_interval) {
+			struct timespec flush_at, left;
+
+			flush_at.tv_sec = outbuf_interval / 1000;
+			flush_at.tv_nsec = outbuf_interval % 1000 * 1000000;
+			ts_add(&flush_at, &flush_at, &outbuf_flushed);
+			if (ts_cmp(&now, &flush_at) >= 0) {
+				flush_buffered(shared_log);
+				continue;
+			}
+			ts_sub(&left, &flush_at, &now);
+			if (!timeout || ts_cmp(&left, timeout) < 0) {
+				ts = left;
+				timeout = &ts;
+			}
+		}
+
+		if (timeout)
+			sig = sigtimedwait(&blocked_set, NULL, timeout);
+		else
+			sig = sigwaitinfo(&blocked_set, NULL);
+		if (sig < 0) {
+			if (errno == EAGAIN)
+				continue;	/* see what is due */
+			return -1;
+		}
+		if (sig == SIGCHLD) {
+			stops_pending = true;
+			continue;
+		}
+
+		if (sig == SIGUSR1)
+			flightrec_request(sig);
+		else
+			interrupt(sig);
+		errno = EINTR;
+		return -1;
+	}
+}
+
+/*
+ * With -A, at the end of each window, detach from everybody and wait
+ * for the next window, then attach to the -p pids again.
+ * Returns false when there is nobody left to trace.
+ */
+static bool
+duty_cycle(void)
+{
+	struct timespec now, ts, next;
+	unsigned int i;
+	int pid, status, sig;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_cmp(&now, &duty_end) < 0)
+		return true;
+
+	detach_all(0);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&ts, &now, &duty_begin);
+	ts_add(&duty_traced, &duty_traced, &ts);
+
+	ts_add(&next, &duty_begin, &duty_period);
+	while (!interrupted) {
+		/*
+		 * Children the kernel attached as the window ended
+		 * may still stop; let them go.
+		 */
+		pid = wait4(-1, &status, __WALL | WNOHANG, NULL);
+		if (pid > 0) {
+			if (WIFSTOPPED(status))
+				ptrace(PTRACE_DETACH, pid, 0, 0);
+			else if (pid == popen_pid)
+				popen_pid = 0;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (ts_cmp(&now, &next) >= 0)
+			break;
+		ts_sub(&ts, &next, &now);
+		sig = sigtimedwait(&blocked_set, NULL, &ts);
+		if (sig > 0 && sig != SIGCHLD)
+			interrupt(sig);
+	}
+	if (interrupted)
+		return false;
+
+	duty_begin = now;
+	ts_add(&duty_end, &duty_begin, &duty_window);
+	stops_pending = true;
+	for (i = 0; i < duty_npids; ++i) {
+		if (!duty_pids[i])
+			continue;
+		attach_tcb(alloctcb(duty_pids[i]));
+		if (!pid2tcb(duty_pids[i]))
+			duty_pids[i] = 0;
+	}
+
+	return nprocs > 0;
+}
+
 /* Returns true iff the main trace loop has to continue. */
 static bool
 trace(void)
@@ -2217,13 +3821,28 @@ trace(void)
 	unsigned int event;
 	struct tcb *tcp;
 	struct rusage ru;
+	bool want_ru;
 
-	if (interrupted)
+	/* With -HH, the snapshot taken on attach is all there is to do.  */
+	if (interrupted || snapshot_flag > 1)
 		return false;
 
+	if (flightrec_size)
+		flightrec_dump_pending();
+
 	if (gdbserver)
 		return gdb_trace();
 
+	/* These wake up every 100ms; wait_for_stop sees to ptrace.  */
+	if (outbuf_interval && backend != BACKEND_PTRACE)
+		flush_buffered(shared_log);
+	if (backend == BACKEND_PERF)
+		return read_perf_events();
+	if (backend == BACKEND_SECCOMP)
+		return read_seccomp_events();
+	if (backend == BACKEND_BPF)
+		return wait_for_tracees();
+
 	/*
 	 * Used to exit simply when nprocs hits zero, but in this testcase:
 	 *  int main() { _exit(!!fork()); }
@@ -2245,15 +3864,26 @@ trace(void)
 			return false;
 	}
 
-	if (interactive)
-		sigprocmask(SIG_SETMASK, &empty_set, NULL);
-	pid = wait4(-1, &status, __WALL, (cflag ? &ru : NULL));
+	if (duty_npids && !duty_cycle())
+		return false;
+
+	/*
+	 * -g may switch to counting at any stop; system times are
+	 * kept up to date so that the first count is not off.
+	 */
+	want_ru = cflag || governor_enabled();
+	if (governor_enabled())
+		governor_wait_begin();
+	if (sigwait_stops)
+		pid = wait_for_stop(&status, (want_ru ? &ru : NULL));
+	else
+		pid = wait4(-1, &status, __WALL, (want_ru ? &ru : NULL));
 	wait_errno = errno;
-	if (interactive)
-		sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+	if (governor_enabled())
+		governor_wait_end();
 
 	if (pid < 0) {
-		if (wait_errno == EINTR)
+		if (wait_errno == EINTR || wait_errno == EAGAIN)
 			return true;
 		if (nprocs == 0 && wait_errno == ECHILD)
 			return false;
@@ -2319,7 +3949,10 @@ trace(void)
 	/* Set current output file */
 	current_tcp = tcp;
 
-	if (cflag) {
+	if (governor_enabled())
+		governor_check(tcp);
+
+	if (want_ru) {
 		tv_sub(&tcp->dtime, &ru.ru_stime, &tcp->stime);
 		tcp->stime = ru.ru_stime;
 	}
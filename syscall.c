@@ -228,6 +228,15 @@ unsigned nioctlents = nioctlents0;
 unsigned num_quals;
 qualbits_t *qual_vec[SUPPORTED_PERSONALITIES];
 
+/* -e latency>=DURATION: show only syscalls that take at least that long */
+struct timespec latency_min;
+
+/* -e status=[!]ERRNO...: show only syscalls failing [not] with these */
+static const char **status_errnos;
+static unsigned int n_status_errnos;
+static bool status_not;
+bool status_filter;
+
 static const unsigned nsyscall_vec[SUPPORTED_PERSONALITIES] = {
 	nsyscalls0,
 #if SUPPORTED_PERSONALITIES > 1
@@ -516,6 +525,34 @@ qual_desc(const char *s, const unsigned int bitflag, const int not)
 	return -1;
 }
 
+static void
+qualify_status(const char *s)
+{
+	char *copy;
+	char *p;
+	unsigned int i;
+
+	if (*s == '!') {
+		status_not = true;
+		s++;
+	}
+	copy = xstrdup(s);
+	for (p = strtok(copy, ","); p; p = strtok(NULL, ",")) {
+		for (i = 0; i < nerrnos; i++) {
+			if (errnoent[i] && strcmp(errnoent[i], p) == 0)
+				break;
+		}
+		if (i >= nerrnos)
+			error_msg_and_die("invalid error name '%s'", p);
+		status_errnos = xreallocarray(status_errnos,
+					      n_status_errnos + 1,
+					      sizeof(*status_errnos));
+		status_errnos[n_status_errnos++] = errnoent[i];
+	}
+	free(copy);
+	status_filter = true;
+}
+
 void
 qualify(const char *s)
 {
@@ -528,6 +565,17 @@ qualify(const char *s)
 	if (num_quals == 0)
 		reallocate_qual(MIN_QUALS);
 
+	if (strncmp(s, "status=", sizeof("status=") - 1) == 0) {
+		qualify_status(s + sizeof("status=") - 1);
+		return;
+	}
+	if (strncmp(s, "latency>=", sizeof("latency>=") - 1) == 0) {
+		s += sizeof("latency>=") - 1;
+		if (parse_duration(s, &latency_min) < 0)
+			error_msg_and_die("invalid latency '%s'", s);
+		return;
+	}
+
 	opt = &qual_options[0];
 	for (i = 0; (p = qual_options[i].option_name); i++) {
 		unsigned int len = strlen(p);
@@ -566,6 +614,50 @@ qualify(const char *s)
 	return;
 }
 
+/*
+ * Return an array of the numbers of syscalls traced in the given
+ * personality, for tracing backends that can filter syscalls themselves.
+ * Traced socket and ipc subcalls are represented by their multiplexer.
+ * execve is included for -b execve and for hiding the log until it,
+ * even if not traced.  Returns NULL if all syscalls are traced.
+ */
+unsigned int *
+traced_scnos(unsigned int personality, unsigned int *count)
+{
+	const unsigned int n = nsyscall_vec[personality];
+	const struct_sysent *const ents = sysent_vec[personality];
+	const qualbits_t *const quals = qual_vec[personality];
+	const bool execve = hide_log_until_execve || detach_on_execve;
+	bool all = true, subcalls = false;
+	unsigned int i;
+
+	for (i = 0; i < n && i < num_quals; ++i) {
+		if (!ents[i].sys_func)
+			continue;
+		if (!(quals[i] & QUAL_TRACE))
+			all = false;
+		else if (ents[i].sys_flags & TRACE_INDIRECT_SUBCALL)
+			subcalls = true;
+	}
+	if (all)
+		return NULL;
+
+	unsigned int *scnos = xcalloc(n, sizeof(*scnos));
+	*count = 0;
+	for (i = 0; i < n && i < num_quals; ++i) {
+		if (!ents[i].sys_func)
+			continue;
+		if (ents[i].sys_flags & TRACE_INDIRECT_SUBCALL)
+			continue;
+		if ((quals[i] & QUAL_TRACE)
+		    || (subcalls && (ents[i].sen == SEN_socketcall
+				     || ents[i].sen == SEN_ipc))
+		    || (execve && ents[i].sen == SEN_execve))
+			scnos[(*count)++] = i;
+	}
+	return scnos;
+}
+
 #ifdef SYS_socket_subcall
 static void
 decode_socket_subcall(struct tcb *tcp)
@@ -793,6 +885,9 @@ static void get_error(struct tcb *, const bool);
 static int getregs_old(pid_t);
 #endif
 
+static void set_sysent(struct tcb *);
+static int decode_syscall_entering(struct tcb *);
+
 static int
 trace_syscall_entering(struct tcb *tcp)
 {
@@ -801,18 +896,48 @@ trace_syscall_entering(struct tcb *tcp)
 	scno_good = res = get_scno(tcp);
 	if (res == 0)
 		return res;
-	if (res == 1)
+	/* With -X perf or seccomp, the arguments came with the event.  */
+	if (res == 1 && backend == BACKEND_PTRACE)
 		res = get_syscall_args(tcp);
+	if (res == 1)
+		return decode_syscall_entering(tcp);
 
-	if (res != 1) {
-		printleader(tcp);
-		tprintf("%s(", scno_good == 1 ? tcp->s_ent->sys_name : "????");
-		/*
-		 * " <unavailable>" will be added later by the code which
-		 * detects ptrace errors.
-		 */
-		goto ret;
-	}
+	if (defer_lines)
+		start_deferred_line(tcp);
+	printleader(tcp);
+	tcp->defer_text = tcp->curcol;
+	tprintf("%s(", scno_good == 1 ? tcp->s_ent->sys_name : "????");
+	if (tcp->flags & TCB_DEFERRED)
+		suspend_deferred_line(tcp);
+	/*
+	 * " <unavailable>" will be added later by the code which
+	 * detects ptrace errors.
+	 */
+	tcp->flags |= TCB_INSYSCALL;
+	tcp->sys_func_rval = res;
+	if (measure_syscall_time)
+		clock_now(&tcp->etime);
+	return res;
+}
+
+/*
+ * -H: show the entry of the syscall TCP is blocked in, with the number
+ * and arguments read from /proc/TID/syscall into tcp->scno and
+ * tcp->u_arg.  TCP is not in a syscall stop, so nothing is taken from
+ * its registers.
+ */
+int
+snapshot_syscall_entering(struct tcb *tcp)
+{
+	set_sysent(tcp);
+	return decode_syscall_entering(tcp);
+}
+
+/* Show the entry of the syscall of TCP, its number and arguments known.  */
+static int
+decode_syscall_entering(struct tcb *tcp)
+{
+	int res;
 
 #ifdef LINUX_MIPSO32
 	if (SEN_syscall == tcp->s_ent->sen)
@@ -851,6 +976,8 @@ trace_syscall_entering(struct tcb *tcp)
 	}
 
 	tcp->flags &= ~TCB_FILTERED;
+	/* The exit is shown, or not, as the entry was.  */
+	tcp->governor_level = governor_level;
 
 	if (cflag == CFLAG_ONLY_STATS || hide_log_until_execve) {
 		res = 0;
@@ -858,41 +985,93 @@ trace_syscall_entering(struct tcb *tcp)
 	}
 
 #ifdef USE_LIBUNWIND
-	if (stack_trace_enabled) {
+	if (stack_trace_enabled && tcp->governor_level < GOVERNOR_NO_STACKS) {
 		if (tcp->s_ent->sys_flags & STACKTRACE_CAPTURE_ON_ENTER)
 			unwind_capture_stacktrace(tcp);
 	}
 #endif
 
+	/*
+	 * exit never returns, its line is completed on entry,
+	 * with -J in memory like any other line.
+	 */
+	if (defer_lines && (SEN_exit != tcp->s_ent->sen || json_output))
+		start_deferred_line(tcp);
+	if (coltrace_fp)
+		tcp->col_path = tcp->col_fd = 0;
+
 	printleader(tcp);
-	tprintf("%s(", tcp->s_ent->sys_name);
+	tcp->defer_text = tcp->curcol;
+	tprints(tcp->s_ent->sys_name);
+	tprints("(");
 	if ((tcp->qual_flg & QUAL_RAW) && SEN_exit != tcp->s_ent->sen)
 		res = printargs(tcp);
 	else
 		res = tcp->s_ent->sys_func(tcp);
 
-	fflush(tcp->outf);
+	if (tcp->flags & TCB_DEFERRED)
+		suspend_deferred_line(tcp);
+	/* Unless output is buffered with -B, show the call while it blocks. */
+	else if (!outbuf_size)
+		fflush(tcp->outf);
  ret:
 	tcp->flags |= TCB_INSYSCALL;
 	tcp->sys_func_rval = res;
 	/* Measure the entrance time as late as possible to avoid errors. */
-	if (Tflag || cflag)
-		gettimeofday(&tcp->etime, NULL);
+	if (measure_syscall_time)
+		clock_now(&tcp->etime);
 	return res;
 }
 
+/*
+ * Return true if the syscall TCP has just left, whose entry was
+ * deferred, is to be shown.  TS is the time of the syscall exit.
+ */
+static bool
+show_deferred_line(struct tcb *tcp, const struct timespec *ts)
+{
+	if (tcp->u_error ? not_failing_only : failing_only)
+		return false;
+
+	if (status_filter) {
+		const char *name = tcp->u_error ? err_name(tcp->u_error) : NULL;
+		bool match = false;
+		unsigned int i;
+
+		for (i = 0; name && i < n_status_errnos; i++) {
+			if (strcmp(name, status_errnos[i]) == 0) {
+				match = true;
+				break;
+			}
+		}
+		if (match == status_not)
+			return false;
+	}
+
+	if (latency_min.tv_sec || latency_min.tv_nsec) {
+		struct timespec dts;
+
+		ts_sub(&dts, ts, &tcp->etime);
+		if (ts_cmp(&dts, &latency_min) < 0)
+			return false;
+	}
+
+	return true;
+}
+
 static int
 trace_syscall_exiting(struct tcb *tcp)
 {
 	int sys_res;
-	struct timeval tv;
+	struct timespec ts;
 	int res;
 	unsigned long u_error;
 	const char *u_error_str;
+	size_t text_end;
 
 	/* Measure the exit time as early as possible to avoid errors. */
-	if (Tflag || cflag)
-		gettimeofday(&tv, NULL);
+	if (measure_syscall_time)
+		clock_now(&ts);
 
 #ifdef USE_LIBUNWIND
 	if (stack_trace_enabled) {
@@ -908,11 +1087,21 @@ trace_syscall_exiting(struct tcb *tcp)
 	if (filtered(tcp) || hide_log_until_execve)
 		goto ret;
 
-	if (cflag) {
-		count_syscall(tcp, &tv);
-		if (cflag == CFLAG_ONLY_STATS) {
+	if (cflag)
+		count_syscall(tcp, &ts);
+	if (governor_enabled() ? tcp->governor_level >= GOVERNOR_COUNT_ONLY
+			       : cflag == CFLAG_ONLY_STATS)
+		goto ret;
+
+	if (tcp->flags & TCB_DEFERRED) {
+		if (res == 1 && !show_deferred_line(tcp, &ts)) {
+			drop_deferred_line(tcp);
 			goto ret;
 		}
+		if ((collapse_repeats && res == 1) || json_output)
+			resume_deferred_line(tcp);
+		else
+			commit_deferred_line(tcp);
 	}
 
 	/* If not in -ff mode, and printing_tcp != tcp,
@@ -924,12 +1113,17 @@ trace_syscall_exiting(struct tcb *tcp)
 	 * "strace -ff -oLOG test/threaded_execve" corner case.
 	 * It's the only case when -ff mode needs reprinting.
 	 */
-	if ((followfork < 2 && printing_tcp != tcp) || (tcp->flags & TCB_REPRINT)) {
+	if (tcp->defer_outf) {
+		/* The whole line is rendered to memory. */
 		tcp->flags &= ~TCB_REPRINT;
-		printleader(tcp);
-		tprintf("<... %s resumed> ", tcp->s_ent->sys_name);
+	} else {
+		if ((followfork < 2 && printing_tcp != tcp) || (tcp->flags & TCB_REPRINT)) {
+			tcp->flags &= ~TCB_REPRINT;
+			printleader(tcp);
+			tprintf("<... %s resumed> ", tcp->s_ent->sys_name);
+		}
+		printing_tcp = tcp;
 	}
-	printing_tcp = tcp;
 
 	tcp->s_prev_ent = NULL;
 	if (res != 1) {
@@ -945,34 +1139,33 @@ trace_syscall_exiting(struct tcb *tcp)
 	}
 	tcp->s_prev_ent = tcp->s_ent;
 
+	if (flightrec_size && flightrec_syscall_trigger(tcp, &ts))
+		flightrec_trigger(tcp);
+
 	sys_res = 0;
 	if (tcp->qual_flg & QUAL_RAW) {
 		/* sys_res = printargs(tcp); - but it's nop on sysexit */
 	} else {
-	/* FIXME: not_failing_only (IOW, option -z) is broken:
-	 * failure of syscall is known only after syscall return.
-	 * Thus we end up with something like this on, say, ENOENT:
-	 *     open("doesnt_exist", O_RDONLY <unfinished ...>
-	 *     {next syscall decode}
-	 * whereas the intended result is that open(...) line
-	 * is not shown at all.
-	 */
-		if (not_failing_only && tcp->u_error)
-			goto ret;	/* ignore failed syscalls */
 		if (tcp->sys_func_rval & RVAL_DECODED)
 			sys_res = tcp->sys_func_rval;
 		else
 			sys_res = tcp->s_ent->sys_func(tcp);
 	}
+	if (coltrace_fp)
+		coltrace_record(tcp, &ts);
 
 	tprints(") ");
 	tabto();
 	u_error = tcp->u_error;
 	if (tcp->qual_flg & QUAL_RAW) {
-		if (u_error)
-			tprintf("= -1 (errno %lu)", u_error);
-		else
-			tprintf("= %#lx", tcp->u_rval);
+		if (u_error) {
+			tprints("= -1 (errno ");
+			tprint_udec(u_error);
+			tprints(")");
+		} else {
+			tprints("= ");
+			tprint_hex((unsigned long) tcp->u_rval);
+		}
 	}
 	else if (!(sys_res & RVAL_NONE) && u_error) {
 		switch (u_error) {
@@ -1031,12 +1224,14 @@ trace_syscall_exiting(struct tcb *tcp)
 			break;
 		default:
 			u_error_str = err_name(u_error);
+			tprints("= -1 ");
 			if (u_error_str)
-				tprintf("= -1 %s (%s)",
-					u_error_str, strerror(u_error));
+				tprints(u_error_str);
 			else
-				tprintf("= -1 %lu (%s)",
-					u_error, strerror(u_error));
+				tprint_udec(u_error);
+			tprints(" (");
+			tprints(strerror(u_error));
+			tprints(")");
 			break;
 		}
 		if ((sys_res & RVAL_STR) && tcp->auxstr)
@@ -1048,37 +1243,37 @@ trace_syscall_exiting(struct tcb *tcp)
 		else {
 			switch (sys_res & RVAL_MASK) {
 			case RVAL_HEX:
+				tprints("= ");
 #if SUPPORTED_PERSONALITIES > 1
 				if (current_wordsize < sizeof(long))
-					tprintf("= %#x",
-						(unsigned int) tcp->u_rval);
+					tprint_hex((unsigned int) tcp->u_rval);
 				else
 #endif
-					tprintf("= %#lx", tcp->u_rval);
+					tprint_hex((unsigned long) tcp->u_rval);
 				break;
 			case RVAL_OCTAL:
 				tprints("= ");
 				print_numeric_long_umask(tcp->u_rval);
 				break;
 			case RVAL_UDECIMAL:
+				tprints("= ");
 #if SUPPORTED_PERSONALITIES > 1
 				if (current_wordsize < sizeof(long))
-					tprintf("= %u",
-						(unsigned int) tcp->u_rval);
+					tprint_udec((unsigned int) tcp->u_rval);
 				else
 #endif
-					tprintf("= %lu", tcp->u_rval);
+					tprint_udec((unsigned long) tcp->u_rval);
 				break;
 			case RVAL_DECIMAL:
-				tprintf("= %ld", tcp->u_rval);
+				tprints("= ");
+				tprint_dec(tcp->u_rval);
 				break;
 			case RVAL_FD:
-				if (show_fd_path) {
-					tprints("= ");
+				tprints("= ");
+				if (show_fd_path)
 					printfd(tcp, tcp->u_rval);
-				}
 				else
-					tprintf("= %ld", tcp->u_rval);
+					tprint_dec(tcp->u_rval);
 				break;
 #if HAVE_STRUCT_TCB_EXT_ARG
 			/*
@@ -1090,7 +1285,8 @@ trace_syscall_exiting(struct tcb *tcp)
 				break;
 			*/
 			case RVAL_LUDECIMAL:
-				tprintf("= %llu", tcp->u_lrval);
+				tprints("= ");
+				tprint_udec(tcp->u_lrval);
 				break;
 			/*
 			case RVAL_LDECIMAL:
@@ -1106,17 +1302,26 @@ trace_syscall_exiting(struct tcb *tcp)
 		if ((sys_res & RVAL_STR) && tcp->auxstr)
 			tprintf(" (%s)", tcp->auxstr);
 	}
+	text_end = tcp->curcol;
 	if (Tflag) {
-		tv_sub(&tv, &tv, &tcp->etime);
-		tprintf(" <%ld.%06ld>",
-			(long) tv.tv_sec, (long) tv.tv_usec);
+		struct timespec dts;
+
+		ts_sub(&dts, &ts, &tcp->etime);
+		tprints(" <");
+		tprint_timespec(&dts, 0);
+		tprints(">");
 	}
 	tprints("\n");
-	dumpio(tcp);
+	if (tcp->defer_outf &&
+	    !finish_deferred_line(tcp, text_end, &ts, sys_res))
+		goto ret;
+	/* Hex dumps are not part of the JSON objects. */
+	if (!json_output)
+		dumpio(tcp);
 	line_ended();
 
 #ifdef USE_LIBUNWIND
-	if (stack_trace_enabled)
+	if (stack_trace_enabled && tcp->governor_level < GOVERNOR_NO_STACKS)
 		unwind_print_stacktrace(tcp);
 #endif
 
@@ -1323,13 +1528,25 @@ get_scno(struct tcb *tcp)
 	if (get_regs_error)
 		return -1;
 
-	int rc = arch_get_scno(tcp);
+	/* With -X perf or seccomp, tcp->scno is known already.  */
+	int rc = backend != BACKEND_PTRACE ? 1 : arch_get_scno(tcp);
 	if (rc != 1)
 		return rc;
 
+	set_sysent(tcp);
+	return 1;
+}
+
+/* Set tcp->s_ent and tcp->qual_flg for tcp->scno.  */
+static void
+set_sysent(struct tcb *tcp)
+{
 	if (SCNO_IS_VALID(tcp->scno)) {
 		tcp->s_ent = &sysent[tcp->scno];
 		tcp->qual_flg = qual_flags[tcp->scno];
+		if (governor_level >= GOVERNOR_ABBREV)
+			tcp->qual_flg = (tcp->qual_flg | QUAL_ABBREV) &
+					~QUAL_VERBOSE;
 	} else {
 		struct sysent_buf *s = xcalloc(1, sizeof(*s));
 
@@ -1348,7 +1565,6 @@ get_scno(struct tcb *tcp)
 		if (debug_flag)
 			error_msg("pid %d invalid syscall %ld", tcp->pid, tcp->scno);
 	}
-	return 1;
 }
 
 #ifdef USE_GET_SYSCALL_RESULT_REGS
@@ -1363,6 +1579,21 @@ static int get_syscall_result_regs(struct tcb *);
 static int
 get_syscall_result(struct tcb *tcp)
 {
+	/* With -X perf, tcp->u_rval came with the event.  */
+	if (backend == BACKEND_PERF) {
+		tcp->u_error = 0;
+		if (!(tcp->s_ent->sys_flags & SYSCALL_NEVER_FAILS) &&
+		    is_negated_errno(tcp->u_rval)) {
+			tcp->u_error = -tcp->u_rval;
+			tcp->u_rval = -1;
+		}
+		return 1;
+	}
+	/* With -X seccomp, syscalls are never seen returning.  */
+	if (backend == BACKEND_SECCOMP) {
+		tcp->u_error = 0;
+		return -1;
+	}
 #ifdef USE_GET_SYSCALL_RESULT_REGS
 	if (get_syscall_result_regs(tcp))
 		return -1;
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Helpers shared by the backends that hook syscall tracepoints
+ * (-X bpf and -X perf): tracefs lookups and CPU lists.
+ */
+
+#include "defs.h"
+#include <limits.h>
+
+/* Open FILE of the tracepoint EVENT in tracefs.  */
+FILE *
+tracefs_fopen(const char *event, const char *file)
+{
+	static const char *const dirs[] = {
+		"/sys/kernel/tracing",
+		"/sys/kernel/debug/tracing",
+	};
+	char path[PATH_MAX];
+	unsigned int i;
+	FILE *fp;
+
+	for (i = 0; i < ARRAY_SIZE(dirs); ++i) {
+		snprintf(path, sizeof(path), "%s/events/%s/%s",
+			 dirs[i], event, file);
+		fp = fopen(path, "r");
+		if (fp)
+			return fp;
+	}
+	return NULL;
+}
+
+/* Return the perf event id of the tracepoint EVENT, or -1.  */
+int
+tracefs_event_id(const char *event)
+{
+	FILE *fp = tracefs_fopen(event, "id");
+	int id = -1;
+
+	if (fp) {
+		if (fscanf(fp, "%d", &id) != 1)
+			id = -1;
+		fclose(fp);
+	}
+	return id;
+}
+
+/* Return the offset of FIELD in the records of EVENT, or -1.  */
+int
+tracefs_field_offset(const char *event, const char *field)
+{
+	FILE *fp = tracefs_fopen(event, "format");
+	char line[256];
+	int off = -1;
+
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		const char *decl = strstr(line, "field:");
+		const char *semi = decl ? strchr(decl, ';') : NULL;
+		size_t len = strlen(field);
+
+		if (!semi || (size_t) (semi - decl) < len ||
+		    strncmp(semi - len, field, len) != 0 ||
+		    !strchr(" *", semi[-len - 1]))
+			continue;
+		if (sscanf(semi, "; offset:%d;", &off) != 1)
+			off = -1;
+		break;
+	}
+	fclose(fp);
+	return off;
+}
+
+/* Return the highest CPU number in the list file PATH, or -1.  */
+int
+cpu_list_max(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	int cpu, max = -1;
+
+	if (!fp)
+		return -1;
+	while (fscanf(fp, "%d", &cpu) == 1) {
+		if (cpu > max)
+			max = cpu;
+		if (fgetc(fp) == EOF)
+			break;
+	}
+	fclose(fp);
+	return max;
+}
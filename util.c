@@ -105,6 +105,74 @@ tv_sub(struct timeval *tv, const struct timeval *a, const struct timeval *b)
 	}
 }
 
+void
+ts_sub(struct timespec *ts, const struct timespec *a, const struct timespec *b)
+{
+	ts->tv_sec = a->tv_sec - b->tv_sec;
+	ts->tv_nsec = a->tv_nsec - b->tv_nsec;
+	if (ts->tv_nsec < 0) {
+		ts->tv_sec--;
+		ts->tv_nsec += 1000000000;
+	}
+}
+
+int
+ts_cmp(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec < b->tv_sec
+	    || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec))
+		return -1;
+	if (a->tv_sec > b->tv_sec
+	    || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec))
+		return 1;
+	return 0;
+}
+
+void
+ts_add(struct timespec *ts, const struct timespec *a, const struct timespec *b)
+{
+	ts->tv_sec = a->tv_sec + b->tv_sec;
+	ts->tv_nsec = a->tv_nsec + b->tv_nsec;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/*
+ * Parse a duration such as "1.5s", "5ms", "200us", or "10ns";
+ * a number without a suffix is in seconds.
+ */
+int
+parse_duration(const char *str, struct timespec *ts)
+{
+	char *end;
+	double d;
+
+	errno = 0;
+	d = strtod(str, &end);
+	if (end == str || errno || !(d >= 0))
+		return -1;
+	if (strcmp(end, "ms") == 0)
+		d /= 1e3;
+	else if (strcmp(end, "us") == 0)
+		d /= 1e6;
+	else if (strcmp(end, "ns") == 0)
+		d /= 1e9;
+	else if (*end && strcmp(end, "s") != 0)
+		return -1;
+	if (d >= (double) LONG_MAX)
+		return -1;
+	ts->tv_sec = d;
+	ts->tv_nsec = (d - ts->tv_sec) * 1e9 + 0.5;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+
+	return 0;
+}
+
 void
 tv_div(struct timeval *tv, const struct timeval *a, int n)
 {
@@ -380,7 +448,8 @@ printflags64(const struct xlat *xlat, uint64_t flags, const char *dflt)
 	sep = "";
 	for (n = 0; xlat->str; xlat++) {
 		if (xlat->val && (flags & xlat->val) == xlat->val) {
-			tprintf("%s%s", sep, xlat->str);
+			tprints(sep);
+			tprints(xlat->str);
 			flags &= ~xlat->val;
 			sep = "|";
 			n++;
@@ -389,12 +458,13 @@ printflags64(const struct xlat *xlat, uint64_t flags, const char *dflt)
 
 	if (n) {
 		if (flags) {
-			tprintf("%s%#" PRIx64, sep, flags);
+			tprints(sep);
+			tprint_hex(flags);
 			n++;
 		}
 	} else {
 		if (flags) {
-			tprintf("%#" PRIx64, flags);
+			tprint_hex(flags);
 			if (dflt)
 				tprintf(" /* %s */", dflt);
 		} else {
@@ -412,7 +482,7 @@ printaddr(const long addr)
 	if (!addr)
 		tprints("NULL");
 	else
-		tprintf("%#lx", addr);
+		tprint_hex((unsigned long) addr);
 }
 
 #define DEF_PRINTNUM(name, type) \
@@ -522,7 +592,8 @@ printfd(struct tcb *tcp, int fd)
 		const size_t socket_prefix_len = sizeof(socket_prefix) - 1;
 		const size_t path_len = strlen(path);
 
-		tprintf("%d<", fd);
+		tprint_dec(fd);
+		tprints("<");
 		if (show_fd_path > 1 &&
 		    strncmp(path, socket_prefix, socket_prefix_len) == 0 &&
 		    path[path_len - 1] == ']') {
@@ -541,7 +612,9 @@ printfd(struct tcb *tcp, int fd)
 		}
 		tprints(">");
 	} else
-		tprintf("%d", fd);
+		tprint_dec(fd);
+	if (coltrace_fp)
+		coltrace_fd(tcp, fd);
 }
 
 /*
@@ -783,6 +856,8 @@ printpathn(struct tcb *tcp, long addr, unsigned int n)
 		print_quoted_string(path, n, QUOTE_0_TERMINATED);
 		if (!nul_seen)
 			tprints("...");
+		else if (coltrace_fp)
+			coltrace_path(tcp, path, strlen(path));
 	}
 }
 
@@ -16,8 +16,8 @@
 #include <stdarg.h>
 #include <limits.h>
 
-#ifndef HAVE_FPUTS_UNLOCKED
-# define fputs_unlocked fputs
+#ifndef HAVE_FWRITE_UNLOCKED
+# define fwrite_unlocked fwrite
 #endif
 
 #define noinline_for_stack /*nothing*/
@@ -766,7 +766,6 @@ int strace_vfprintf(FILE *fp, const char *fmt, va_list args)
 	static char *buf = NULL;
 	static unsigned buflen = 0;
 
-	int r;
 	va_list a1;
 
 	va_copy(a1, args);
@@ -780,8 +779,9 @@ int strace_vfprintf(FILE *fp, const char *fmt, va_list args)
 		/*len =*/ kernel_vsnprintf(buf, buflen, fmt, args);
 	}
 
-	r = fputs_unlocked(buf, fp);
-	if (r < 0) return r;
+	/* The length is already known, there is no need to scan for NUL.  */
+	if (fwrite_unlocked(buf, 1, len, fp) != len)
+		return -1;
 	return len;
 }
 